@@ -0,0 +1,187 @@
+#include "admissioncontrol.h"
+
+#include <QAbstractSocket>
+#include <QHostAddress>
+#include <QStringList>
+
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+
+// The 16 bytes of an IPv6 address, or of the mapped IPv4 one.
+static void
+toIPv6(const QHostAddress &host, quint8 *address) {
+    const Q_IPV6ADDR bytes = host.toIPv6Address();
+    memcpy(address, bytes.c, 16);
+}
+
+
+//============================================================================//
+//                              AdmissionControl                              //
+//============================================================================//
+
+bool
+AdmissionControl::parse(const QString &list, QVector<Subnet> *subnets, QString *error) {
+    subnets->clear();
+    if (list.trimmed().isEmpty())
+        return true;
+    const QStringList items = list.split(QLatin1Char(','));
+    for (const QString &item : items) {
+        const QString trimmed = item.trimmed();
+        Subnet subnet;
+        QPair<QHostAddress, int> parsed(QHostAddress(trimmed), -1);
+        const bool hasPrefix = trimmed.contains(QLatin1Char('/'));
+        if (hasPrefix)
+            parsed = QHostAddress::parseSubnet(trimmed);
+        if (parsed.first.isNull()) {
+            // parseSubnet() also refuses prefix lengths out of range.
+            if (hasPrefix)
+                *error = QStringLiteral("\"%1\" is not a subnet with a valid prefix length");
+            else
+                *error = QStringLiteral("\"%1\" is not an address");
+            *error = error->arg(trimmed);
+            return false;
+        }
+        const bool ipv4 = parsed.first.protocol() == QAbstractSocket::IPv4Protocol;
+        const int maxLength = ipv4 ? 32 : 128;
+        if (parsed.second < 0 && !hasPrefix)
+            parsed.second = maxLength;
+        // isAllowed() compares prefixLength bits of the 16-byte address.
+        if (parsed.second < 0 || parsed.second > maxLength) {
+            *error = QStringLiteral("\"%1\" has a prefix length outside 0 to %2")
+                .arg(trimmed).arg(maxLength);
+            return false;
+        }
+        subnet.prefixLength = ipv4 ? parsed.second + 96 : parsed.second;
+        toIPv6(parsed.first, subnet.address);
+        subnets->append(subnet);
+    }
+    return true;
+}
+
+
+AdmissionControl::AdmissionControl()
+    : m_rate(0.0f)
+    , m_burst(0.0f)
+{
+    memset(m_buckets, 0, sizeof(m_buckets));
+}
+
+
+void
+AdmissionControl::setAllowedSources(const QVector<Subnet> &subnets) {
+    m_allowed = subnets;
+}
+
+
+void
+AdmissionControl::setRate(int rate) {
+    m_rate = float(qMax(0, rate));
+    m_burst = qMax(1.0f, m_rate / 10.0f);
+}
+
+
+bool
+AdmissionControl::admit(const sockaddr *source, qint64 now) {
+#ifdef Q_OS_LINUX
+    quint8 address[16];
+    if (source->sa_family == AF_INET6) {
+        memcpy(address, &reinterpret_cast<const sockaddr_in6 *>(source)->sin6_addr, 16);
+    } else if (source->sa_family == AF_INET) {
+        static const quint8 Mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+        memcpy(address, Mapped, 12);
+        memcpy(address + 12, &reinterpret_cast<const sockaddr_in *>(source)->sin_addr, 4);
+    } else {
+        return true;
+    }
+    return admit(address, now);
+#else
+    Q_UNUSED(source);
+    Q_UNUSED(now);
+    return true;
+#endif
+}
+
+
+bool
+AdmissionControl::admit(const QHostAddress &source, qint64 now) {
+    quint8 address[16];
+    toIPv6(source, address);
+    return admit(address, now);
+}
+
+
+void
+AdmissionControl::addStatistics(ReceiverStatistics *statistics) const {
+    statistics->refused += m_refused.value();
+    statistics->rateLimited += m_rateLimited.value();
+}
+
+
+bool
+AdmissionControl::admit(const quint8 *address, qint64 now) {
+    if (!m_allowed.isEmpty() && !isAllowed(address)) {
+        m_refused.add();
+        return false;
+    }
+    if (m_rate == 0.0f)
+        return true;
+
+    quint64 key[2];
+    memcpy(key, address, 16);
+    const quint64 hash = (key[0] ^ (key[1] * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+    const int home = int(hash >> 54) & (TableSize - 1);
+    Bucket *bucket = nullptr;
+    Bucket *oldest = &m_buckets[home];
+    for (int probe = 0; probe < MaxProbes; ++probe) {
+        Bucket &candidate = m_buckets[(home + probe) & (TableSize - 1)];
+        if (candidate.used && candidate.key[0] == key[0] && candidate.key[1] == key[1]) {
+            bucket = &candidate;
+            break;
+        }
+        if (!candidate.used || candidate.lastRefill < oldest->lastRefill)
+            oldest = &candidate;
+        if (!candidate.used)
+            break;
+    }
+    if (!bucket) {
+        // A new source starts with a full bucket.
+        bucket = oldest;
+        bucket->key[0] = key[0];
+        bucket->key[1] = key[1];
+        bucket->tokens = m_burst;
+        bucket->lastRefill = now;
+        bucket->used = true;
+    }
+
+    const qint64 elapsed = now - bucket->lastRefill;
+    if (elapsed > 0) {
+        bucket->tokens = qMin(m_burst, bucket->tokens + float(elapsed * 1.0e-9 * m_rate));
+        bucket->lastRefill = now;
+    }
+    if (bucket->tokens < 1.0f) {
+        m_rateLimited.add();
+        return false;
+    }
+    bucket->tokens -= 1.0f;
+    return true;
+}
+
+
+bool
+AdmissionControl::isAllowed(const quint8 *address) const {
+    for (const Subnet &subnet : m_allowed) {
+        const int bytes = subnet.prefixLength / 8;
+        const int bits = subnet.prefixLength % 8;
+        if (memcmp(address, subnet.address, bytes) != 0)
+            continue;
+        const quint8 mask = quint8(0xff << (8 - bits));
+        if (bits == 0 || ((address[bytes] ^ subnet.address[bytes]) & mask) == 0)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "sensorstatistics.h"
+
+#include <QString>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+class QHostAddress;
+QT_END_NAMESPACE
+
+struct sockaddr;
+
+
+// Decides, before a datagram is parsed, whether its source may send to
+// us at all and whether it is within its rate, so that a flooding or
+// unknown host costs a table lookup per datagram rather than its parsing.
+//
+// Sources are hosts, whatever their port. Sources outside the allow-list,
+// if there is one, are refused. Each source has a token bucket of
+// rate / 10 datagrams, that is 100 ms worth at its rate, refilled at rate
+// datagrams per second; datagrams that find it empty are dropped. The
+// buckets live in a fixed-size table which, when full, forgets the source
+// heard from least recently among the ones a new source could take the
+// place of. Nothing is allocated after construction.
+//
+// Each receiving thread owns its own AdmissionControl.
+class AdmissionControl
+{
+public:
+    enum {
+        TableSize = 1024,
+        // Entries a source may take in the table, from the one its
+        // address hashes to.
+        MaxProbes = 8
+    };
+
+    // An IPv6 subnet; IPv4 ones are stored mapped.
+    struct Subnet
+    {
+        quint8 address[16];
+        int prefixLength;
+    };
+
+    // Parses a comma-separated list of addresses and subnets, such as
+    // "192.168.1.0/24,10.0.0.7,fd00::/8". On failure, error says which
+    // entry is wrong and why.
+    static bool parse(const QString &list, QVector<Subnet> *subnets, QString *error);
+
+    AdmissionControl();
+    AdmissionControl(const AdmissionControl &) = delete;
+    AdmissionControl &operator=(const AdmissionControl &) = delete;
+
+    // Empty to allow every source.
+    void setAllowedSources(const QVector<Subnet> &subnets);
+    // Datagrams per second and source; 0 for no limit.
+    void setRate(int rate);
+
+    bool admit(const sockaddr *source, qint64 now);
+    bool admit(const QHostAddress &source, qint64 now);
+    // Adds the datagrams turned away to statistics.
+    void addStatistics(ReceiverStatistics *statistics) const;
+
+private:
+    struct Bucket
+    {
+        quint64 key[2];
+        qint64 lastRefill;
+        float tokens;
+        bool used;
+    };
+
+    bool admit(const quint8 *address, qint64 now);
+    bool isAllowed(const quint8 *address) const;
+
+    QVector<Subnet> m_allowed;
+    float m_rate;
+    float m_burst;
+    Bucket m_buckets[TableSize];
+    StatisticsCounter m_refused;
+    StatisticsCounter m_rateLimited;
+};
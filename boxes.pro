@@ -1,6 +1,7 @@
 QT += opengl
 QT += widgets
 QT += multimedia
+QT += network
 
 
 requires(qtConfig(combobox))
@@ -9,38 +10,96 @@ requires(qtConfig(combobox))
 qtConfig(opengles.|angle|dynamicgl): error("This example requires Qt to be configured with -opengl desktop")
 
 
+# Lets the compiler vectorize square roots, as in ImuFusion.
+gcc: QMAKE_CXXFLAGS += -fno-math-errno
+
+
 HEADERS += 3rdparty/fbm.h \
+           admissioncontrol.h \
+           calibration.h \
+           calibrator.h \
+           clocksync.h \
            coloredit.h \
+           datagrambatch.h \
            floatedit.h \
            glbuffers.h \
            glextensions.h \
            gltrianglemesh.h \
            graphicsview.h \
            graphicswidget.h \
+           hotlog.h \
+           imufusion.h \
            itemdialog.h \
+           jitterbuffer.h \
+           latencyhistogram.h \
+           orientationfilter.h \
+           oscprotocol.h \
+           packethandler.h \
            parameteredit.h \
            qtbox.h \
+           quaternionmath.h \
            renderoptionsdialog.h \
            roundedbox.h \
+           samplebus.h \
+           samplerecorder.h \
            scene.h \
+           sensorclock.h \
+           sensoroptions.h \
+           sensorprotocol.h \
+           sensorreceiver.h \
+           sensorrelay.h \
+           sensorsample.h \
+           sensorstatistics.h \
+           sensortable.h \
+           serialframer.h \
+           serialsource.h \
+           sharedmemoryring.h \
+           sharedmemorysource.h \
+           seqlock.h \
+           streamaligner.h \
+           threadtuning.h \
            trackball.h \
-           twosidedgraphicswidget.h
+           twosidedgraphicswidget.h \
+           velocityestimator.h
 
 SOURCES += 3rdparty/fbm.c \
+           admissioncontrol.cpp \
+           calibrator.cpp \
+           clocksync.cpp \
            coloredit.cpp \
+           datagrambatch.cpp \
            floatedit.cpp \
            glbuffers.cpp \
            glextensions.cpp \
            graphicsview.cpp \
            graphicswidget.cpp \
+           hotlog.cpp \
+           imufusion.cpp \
            itemdialog.cpp \
+           jitterbuffer.cpp \
+           latencyhistogram.cpp \
            main.cpp \
+           orientationfilter.cpp \
+           oscprotocol.cpp \
+           packethandler.cpp \
            qtbox.cpp \
            renderoptionsdialog.cpp \
            roundedbox.cpp \
+           samplebus.cpp \
+           samplerecorder.cpp \
            scene.cpp \
+           sensorprotocol.cpp \
+           sensorreceiver.cpp \
+           sensorrelay.cpp \
+           sensortable.cpp \
+           serialframer.cpp \
+           serialsource.cpp \
+           sharedmemorysource.cpp \
+           streamaligner.cpp \
+           threadtuning.cpp \
            trackball.cpp \
-           twosidedgraphicswidget.cpp
+           twosidedgraphicswidget.cpp \
+           velocityestimator.cpp
 
 RESOURCES += boxes.qrc
 
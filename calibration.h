@@ -0,0 +1,18 @@
+#pragma once
+
+#include "quaternionmath.h"
+
+
+// Calibration of one sensor stream. The orientation published for a
+// sample q is
+//
+//    conjugate(reference) * q * mounting
+//
+// mounting turning the sensor's frame into that of the body segment it is
+// strapped to, and reference being that segment's orientation in the pose
+// captured as the zero (tare), so that the pose is drawn as the identity.
+struct Calibration
+{
+    QuaternionMath::Quaternion reference = { 1.0f, 0.0f, 0.0f, 0.0f };
+    QuaternionMath::Quaternion mounting = { 1.0f, 0.0f, 0.0f, 0.0f };
+};
@@ -0,0 +1,174 @@
+#include "calibrator.h"
+
+#include <QSettings>
+#include <QStringList>
+
+
+static bool
+readQuaternion(const QSettings &settings, const QString &key, QuaternionMath::Quaternion *q) {
+    if (!settings.contains(key))
+        return true;
+    const QStringList fields = settings.value(key).toString().simplified().split(QLatin1Char(' '));
+    if (fields.size() != 4)
+        return false;
+    float values[4];
+    for (int i = 0; i < 4; ++i) {
+        bool ok;
+        values[i] = fields[i].toFloat(&ok);
+        if (!ok)
+            return false;
+    }
+    *q = QuaternionMath::normalized({ values[0], values[1], values[2], values[3] });
+    return true;
+}
+
+
+static QString
+quaternionString(const QuaternionMath::Quaternion &q) {
+    return QStringLiteral("%1 %2 %3 %4").arg(q.w).arg(q.x).arg(q.y).arg(q.z);
+}
+
+
+//============================================================================//
+//                                 Calibrator                                 //
+//============================================================================//
+
+Calibrator::Calibrator(SensorTable *table)
+    : m_table(table)
+{
+    for (int i = 0; i < Capacity; ++i) {
+        m_r0[i] = m_m0[i] = 1.0f;
+        m_r1[i] = m_r2[i] = m_r3[i] = 0.0f;
+        m_m1[i] = m_m2[i] = m_m3[i] = 0.0f;
+        // Never a sequence of the table, so read on first use.
+        m_sequence[i] = 1;
+    }
+}
+
+
+void
+Calibrator::update(SensorSample *samples, int count) {
+    int lanes = 0;
+    for (int i = 0; i < count; ++i) {
+        SensorSample &sample = samples[i];
+        // Accepted samples all have IDs in range.
+        const int id = sample.sensorId;
+        if (m_table->takeTareRequest(id, sample.arrivalTime))
+            m_table->captureReference(id, sample.orientation());
+        const quint32 sequence = m_table->calibrationSequence(id);
+        if (sequence != m_sequence[id])
+            refresh(id, sequence);
+        m_batch.q0[lanes] = sample.w;
+        m_batch.q1[lanes] = sample.x;
+        m_batch.q2[lanes] = sample.y;
+        m_batch.q3[lanes] = sample.z;
+        m_batch.r0[lanes] = m_r0[id];
+        m_batch.r1[lanes] = m_r1[id];
+        m_batch.r2[lanes] = m_r2[id];
+        m_batch.r3[lanes] = m_r3[id];
+        m_batch.m0[lanes] = m_m0[id];
+        m_batch.m1[lanes] = m_m1[id];
+        m_batch.m2[lanes] = m_m2[id];
+        m_batch.m3[lanes] = m_m3[id];
+        m_batch.sample[lanes] = i;
+        ++lanes;
+    }
+    if (lanes == 0)
+        return;
+
+    // Round up to a multiple of 8 lanes, so that the loop below needs no
+    // scalar remainder; what the extra lanes hold does not matter.
+    const int padded = (lanes + 7) & ~7;
+    Batch &b = m_batch;
+    for (int j = 0; j < padded; ++j) {
+        // t = q * mounting
+        const float q0 = b.q0[j], q1 = b.q1[j], q2 = b.q2[j], q3 = b.q3[j];
+        const float m0 = b.m0[j], m1 = b.m1[j], m2 = b.m2[j], m3 = b.m3[j];
+        const float t0 = q0 * m0 - q1 * m1 - q2 * m2 - q3 * m3;
+        const float t1 = q0 * m1 + q1 * m0 + q2 * m3 - q3 * m2;
+        const float t2 = q0 * m2 - q1 * m3 + q2 * m0 + q3 * m1;
+        const float t3 = q0 * m3 + q1 * m2 - q2 * m1 + q3 * m0;
+        // conjugate(reference) * t
+        const float r0 = b.r0[j], r1 = b.r1[j], r2 = b.r2[j], r3 = b.r3[j];
+        b.q0[j] = r0 * t0 - r1 * t1 - r2 * t2 - r3 * t3;
+        b.q1[j] = r0 * t1 + r1 * t0 + r2 * t3 - r3 * t2;
+        b.q2[j] = r0 * t2 - r1 * t3 + r2 * t0 + r3 * t1;
+        b.q3[j] = r0 * t3 + r1 * t2 - r2 * t1 + r3 * t0;
+    }
+
+    for (int j = 0; j < lanes; ++j) {
+        SensorSample &sample = samples[b.sample[j]];
+        sample.w = b.q0[j];
+        sample.x = b.q1[j];
+        sample.y = b.q2[j];
+        sample.z = b.q3[j];
+    }
+}
+
+
+// Reads a changed calibration. If a writer is busy with it, the old one
+// is kept for now and the next sample tries again.
+void
+Calibrator::refresh(int sensorId, quint32 sequence) {
+    Calibration calibration;
+    if (!m_table->loadCalibration(sensorId, &calibration))
+        return;
+    const QuaternionMath::Quaternion reference = QuaternionMath::conjugate(calibration.reference);
+    m_r0[sensorId] = reference.w;
+    m_r1[sensorId] = reference.x;
+    m_r2[sensorId] = reference.y;
+    m_r3[sensorId] = reference.z;
+    m_m0[sensorId] = calibration.mounting.w;
+    m_m1[sensorId] = calibration.mounting.x;
+    m_m2[sensorId] = calibration.mounting.y;
+    m_m3[sensorId] = calibration.mounting.z;
+    m_sequence[sensorId] = sequence;
+}
+
+
+bool
+Calibrator::load(const QString &path, SensorTable *table) {
+    QSettings settings(path, QSettings::IniFormat);
+    if (settings.status() != QSettings::NoError)
+        return false;
+    bool ok = true;
+    const QStringList groups = settings.childGroups();
+    for (const QString &group : groups) {
+        if (!group.startsWith(QLatin1String("sensor")))
+            continue;
+        bool isNumber;
+        const int id = group.mid(6).toInt(&isNumber);
+        if (!isNumber || id < 0 || id >= Capacity) {
+            ok = false;
+            continue;
+        }
+        Calibration calibration;
+        settings.beginGroup(group);
+        if (readQuaternion(settings, QStringLiteral("reference"), &calibration.reference)
+                && readQuaternion(settings, QStringLiteral("mounting"), &calibration.mounting))
+            table->setCalibration(id, calibration);
+        else
+            ok = false;
+        settings.endGroup();
+    }
+    return ok;
+}
+
+
+bool
+Calibrator::save(const QString &path, const SensorTable &table) {
+    QSettings settings(path, QSettings::IniFormat);
+    settings.clear();
+    for (int id = 0; id < Capacity; ++id) {
+        const Calibration calibration = table.calibration(id);
+        const bool identity = calibration.reference.w == 1.0f && calibration.mounting.w == 1.0f;
+        if (identity)
+            continue;
+        settings.beginGroup(QStringLiteral("sensor%1").arg(id));
+        settings.setValue(QStringLiteral("reference"), quaternionString(calibration.reference));
+        settings.setValue(QStringLiteral("mounting"), quaternionString(calibration.mounting));
+        settings.endGroup();
+    }
+    settings.sync();
+    return settings.status() == QSettings::NoError;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "sensorprotocol.h"
+#include "sensortable.h"
+
+#include <QString>
+
+
+// Applies the calibration of every stream to its samples on ingest, so
+// that the render path only ever sees calibrated orientations.
+//
+// Each input thread's PacketHandler owns a Calibrator, which keeps a copy
+// of the calibration of each stream in structure-of-arrays form, refreshed
+// from the SensorTable only when it changes, and rotates the samples of a
+// packet together in one branch-free loop the compiler vectorizes. It is
+// only given the samples SensorTable::admit() accepted. A tare asked for
+// with SensorTable::requestTare() is taken here, from the next such
+// sample of the stream if it comes within SensorTable::TareTimeout.
+class Calibrator
+{
+public:
+    enum { Capacity = SensorTable::Capacity };
+
+    explicit Calibrator(SensorTable *table);
+    Calibrator(const Calibrator &) = delete;
+    Calibrator &operator=(const Calibrator &) = delete;
+
+    void update(SensorSample *samples, int count);
+
+    // An INI file with a group per calibrated sensor, such as
+    //
+    //    [sensor3]
+    //    reference=0.7071 0 0 0.7071
+    //    mounting=1 0 0 0
+    //
+    // quaternions given as w x y z. Missing entries are the identity.
+    static bool load(const QString &path, SensorTable *table);
+    static bool save(const QString &path, const SensorTable &table);
+
+private:
+    // A multiple of any vector width, and room for a whole packet.
+    enum { Lanes = SensorProtocol::MaxSamples + 1 };
+
+    void refresh(int sensorId, quint32 sequence);
+
+    SensorTable *m_table;
+    // Per sensor: the conjugate of the reference, the mounting rotation and
+    // the calibration sequence they were read at.
+    alignas(64) float m_r0[Capacity];
+    alignas(64) float m_r1[Capacity];
+    alignas(64) float m_r2[Capacity];
+    alignas(64) float m_r3[Capacity];
+    alignas(64) float m_m0[Capacity];
+    alignas(64) float m_m1[Capacity];
+    alignas(64) float m_m2[Capacity];
+    alignas(64) float m_m3[Capacity];
+    quint32 m_sequence[Capacity];
+
+    // The lanes of the batch being rotated.
+    struct Batch
+    {
+        alignas(64) float q0[Lanes];
+        alignas(64) float q1[Lanes];
+        alignas(64) float q2[Lanes];
+        alignas(64) float q3[Lanes];
+        alignas(64) float r0[Lanes];
+        alignas(64) float r1[Lanes];
+        alignas(64) float r2[Lanes];
+        alignas(64) float r3[Lanes];
+        alignas(64) float m0[Lanes];
+        alignas(64) float m1[Lanes];
+        alignas(64) float m2[Lanes];
+        alignas(64) float m3[Lanes];
+        int sample[Lanes];
+    };
+    Batch m_batch;
+};
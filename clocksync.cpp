@@ -0,0 +1,135 @@
+#include "clocksync.h"
+
+#include <cmath>
+
+
+//============================================================================//
+//                                  ClockSync                                 //
+//============================================================================//
+
+// An offset further than this from the fitted line, measured by an
+// exchange quick enough to be trusted, means the sender's clock jumped.
+static const qint64 StepThreshold = 10000000;
+// Exchanges are fitted if their delay is within this of the quickest one's,
+// in nanoseconds; the error of an exchange is up to half its queueing.
+static const qint64 DelayMargin = 100000;
+// Drift is only estimated over at least this span of sender time.
+static const qint64 MinimumDriftSpan = 2000000000;
+// Crystal oscillators are a lot better than this; a larger slope is noise.
+static const double MaximumDrift = 500.0e-6;
+
+
+ClockSync::ClockSync() {
+    for (int i = 0; i < Capacity; ++i)
+        m_clockOf[i] = -1;
+}
+
+
+void
+ClockSync::update(const SensorProtocol::ClockRequest &request) {
+    const SensorProtocol::ClockExchange &exchange = request.previous;
+    if (request.sensorId >= Capacity || exchange.origin == 0 || exchange.arrival == 0)
+        return;
+    const qint64 delay = (exchange.arrival - exchange.origin) - (exchange.transmit - exchange.receive);
+    if (delay < 0)
+        return;
+    const qint64 offset = ((exchange.receive - exchange.origin)
+                           + (exchange.transmit - exchange.arrival)) / 2;
+    const qint64 time = exchange.origin + (exchange.arrival - exchange.origin) / 2;
+
+    assign(request.sensorId, qBound(1, int(request.sensorCount), int(MaxSensors)));
+    Clock &clock = m_clocks[request.sensorId];
+    if (clock.valid && delay < StepThreshold
+            && std::abs(offset - predict(clock, time)) > StepThreshold) {
+        clock.count = 0;
+        clock.next = 0;
+    }
+    clock.time[clock.next] = time;
+    clock.offset[clock.next] = offset;
+    clock.delay[clock.next] = delay;
+    clock.next = (clock.next + 1) % Window;
+    clock.count = qMin(clock.count + 1, int(Window));
+    fit(&clock);
+}
+
+
+// Puts the sensorCount IDs from clockId on that clock, but for those on
+// another one, and takes off those it no longer names.
+void
+ClockSync::assign(int clockId, int sensorCount) {
+    Clock &clock = m_clocks[clockId];
+    const int last = qMin(clockId + qMax(sensorCount, clock.sensorCount), int(Capacity));
+    m_clockOf[clockId] = clockId;
+    for (int id = clockId + 1; id < last; ++id) {
+        if (id - clockId < sensorCount) {
+            if (m_clockOf[id] < 0)
+                m_clockOf[id] = clockId;
+        } else if (m_clockOf[id] == clockId) {
+            m_clockOf[id] = -1;
+        }
+    }
+    clock.sensorCount = sensorCount;
+}
+
+
+bool
+ClockSync::toLocal(int sensorId, qint64 senderTime, qint64 *localTime) const {
+    if (sensorId >= Capacity || m_clockOf[sensorId] < 0)
+        return false;
+    const Clock &clock = m_clocks[m_clockOf[sensorId]];
+    if (!clock.valid)
+        return false;
+    *localTime = senderTime + predict(clock, senderTime);
+    return true;
+}
+
+
+// Least-squares line through the offsets of the quick exchanges, relative
+// to the newest of them.
+void
+ClockSync::fit(Clock *clock) {
+    qint64 quickest = clock->delay[0];
+    for (int i = 1; i < clock->count; ++i)
+        quickest = qMin(quickest, clock->delay[i]);
+    const qint64 limit = quickest + DelayMargin;
+
+    qint64 reference = 0;
+    qint64 earliest = 0;
+    for (int i = 0; i < clock->count; ++i) {
+        if (clock->delay[i] > limit)
+            continue;
+        if (reference == 0 || clock->time[i] > reference)
+            reference = clock->time[i];
+        if (earliest == 0 || clock->time[i] < earliest)
+            earliest = clock->time[i];
+    }
+    double n = 0.0, sumT = 0.0, sumO = 0.0, sumTT = 0.0, sumTO = 0.0;
+    for (int i = 0; i < clock->count; ++i) {
+        if (clock->delay[i] > limit)
+            continue;
+        const double t = double(clock->time[i] - reference);
+        const double o = double(clock->offset[i]);
+        n += 1.0;
+        sumT += t;
+        sumO += o;
+        sumTT += t * t;
+        sumTO += t * o;
+    }
+    double drift = 0.0;
+    if (n >= 3.0 && reference - earliest >= MinimumDriftSpan) {
+        const double variance = n * sumTT - sumT * sumT;
+        if (variance > 0.0)
+            drift = qBound(-MaximumDrift, (n * sumTO - sumT * sumO) / variance, MaximumDrift);
+    }
+    clock->reference = reference;
+    clock->base = (sumO - drift * sumT) / n;
+    clock->drift = drift;
+    clock->valid = true;
+}
+
+
+// Offset of the clock at senderTime, from its fitted line.
+qint64
+ClockSync::predict(const Clock &clock, qint64 senderTime) {
+    return qint64(clock.base + clock.drift * double(senderTime - clock.reference));
+}
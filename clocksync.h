@@ -0,0 +1,76 @@
+#pragma once
+
+#include "sensorprotocol.h"
+#include "sensortable.h"
+
+
+// Maps the clocks of senders onto SensorClock, from the NTP-style
+// exchanges of their time requests (see SensorProtocol).
+//
+// Each exchange measures the offset between the two clocks to within half
+// its round-trip delay. The mapping of a sender is a straight line fitted
+// through the offsets of its recent exchanges, which follows the drift of
+// its oscillator between exchanges; exchanges that took much longer than
+// the quickest ones were probably queued somewhere on the way and are left
+// out. A sudden jump of the offset, as when a sender restarts, starts the
+// estimate over.
+//
+// Each input thread's PacketHandler owns its own ClockSync, so a sender
+// should send its time requests over the same input as its samples.
+//
+// Time requests are not authenticated, any more than samples are: whoever
+// can send samples for a sensor can also misdate them. What one request
+// can disturb is bounded, though. A clock covers at most MaxSensors IDs,
+// and only claims those that are on no other clock: the sensor a request
+// is from is always moved onto its own clock, but the others it names
+// stay where they are until their clock gives them up, by naming fewer
+// sensors. Sources can be restricted with AdmissionControl.
+class ClockSync
+{
+public:
+    enum {
+        Capacity = SensorTable::Capacity,
+        // Most sensor IDs that can share one clock.
+        MaxSensors = 16
+    };
+
+    ClockSync();
+    ClockSync(const ClockSync &) = delete;
+    ClockSync &operator=(const ClockSync &) = delete;
+
+    void update(const SensorProtocol::ClockRequest &request);
+
+    // Maps senderTime of sensorId onto SensorClock. Returns false if the
+    // clock of that sensor has not been synchronized yet.
+    bool toLocal(int sensorId, qint64 senderTime, qint64 *localTime) const;
+
+private:
+    enum { Window = 32 };
+
+    struct Clock
+    {
+        // The last Window exchanges: sender time, offset (ours minus the
+        // sender's) and round-trip delay, all in nanoseconds.
+        qint64 time[Window];
+        qint64 offset[Window];
+        qint64 delay[Window];
+        int count = 0;
+        int next = 0;
+        // The fitted line: offset at reference time, and drift.
+        qint64 reference = 0;
+        double base = 0.0;
+        double drift = 0.0;
+        bool valid = false;
+        // Sensor IDs on this clock, from its own.
+        int sensorCount = 0;
+    };
+
+    void assign(int clockId, int sensorCount);
+
+    void fit(Clock *clock);
+    static qint64 predict(const Clock &clock, qint64 senderTime);
+
+    // Index in m_clocks of the clock each sensor is on, or -1 if unknown.
+    int m_clockOf[Capacity];
+    Clock m_clocks[Capacity];
+};
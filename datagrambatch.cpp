@@ -0,0 +1,133 @@
+#include "datagrambatch.h"
+
+#ifdef Q_OS_LINUX
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+
+//============================================================================//
+//                                DatagramBatch                               //
+//============================================================================//
+
+DatagramBatch::DatagramBatch() {
+    memset(m_messages, 0, sizeof(m_messages));
+    for (int i = 0; i < Capacity; ++i) {
+        m_iovecs[i].iov_base = m_buffers[i];
+        m_iovecs[i].iov_len = BufferSize;
+        m_messages[i].msg_hdr.msg_iov = &m_iovecs[i];
+        m_messages[i].msg_hdr.msg_iovlen = 1;
+        m_messages[i].msg_hdr.msg_name = &m_addresses[i];
+    }
+}
+
+
+// Opens a non-blocking UDP socket bound to the wildcard address,
+// dual-stack when IPv6 is available, sharing the port with other sockets
+// of this process through SO_REUSEPORT if shared. Returns -1 on failure.
+int
+DatagramBatch::openSocket(quint16 port, bool shared) {
+    const int on = 1;
+    const int off = 0;
+    int fd = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd >= 0) {
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        // Only receive the multicast groups this socket joined itself.
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, &off, sizeof(off));
+        setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_ALL, &off, sizeof(off));
+        if (shared)
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+        sockaddr_in6 address = {};
+        address.sin6_family = AF_INET6;
+        address.sin6_addr = in6addr_any;
+        address.sin6_port = htons(port);
+        if (::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0)
+            return fd;
+        close(fd);
+    }
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (shared)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, &off, sizeof(off));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0)
+        return fd;
+    close(fd);
+    return -1;
+}
+
+
+bool
+DatagramBatch::enableTimestamps(int fd) {
+    int on = 1;
+    return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0;
+}
+
+
+bool
+DatagramBatch::enableDropCount(int fd) {
+    int on = 1;
+    return setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) == 0;
+}
+
+
+int
+DatagramBatch::receive(int fd) {
+    // The kernel shrinks msg_controllen and msg_namelen to what it
+    // actually wrote.
+    for (int i = 0; i < Capacity; ++i) {
+        m_messages[i].msg_hdr.msg_control = m_control[i];
+        m_messages[i].msg_hdr.msg_controllen = ControlSize;
+        m_messages[i].msg_hdr.msg_namelen = sizeof(m_addresses[i]);
+    }
+    int n;
+    do {
+        n = recvmmsg(fd, m_messages, Capacity, MSG_DONTWAIT, nullptr);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    return n;
+}
+
+
+const void *
+DatagramBatch::controlData(int i, int type) const {
+    msghdr *header = const_cast<msghdr *>(&m_messages[i].msg_hdr);
+    for (cmsghdr *c = CMSG_FIRSTHDR(header); c; c = CMSG_NXTHDR(header, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == type)
+            return CMSG_DATA(c);
+    }
+    return nullptr;
+}
+
+
+qint64
+DatagramBatch::arrivalTime(int i) const {
+    const void *data = controlData(i, SCM_TIMESTAMPNS);
+    if (!data)
+        return 0;
+    timespec ts;
+    memcpy(&ts, data, sizeof(ts));
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+
+bool
+DatagramBatch::dropCount(int i, quint32 *count) const {
+    const void *data = controlData(i, SO_RXQ_OVFL);
+    if (!data)
+        return false;
+    memcpy(count, data, sizeof(*count));
+    return true;
+}
+
+#endif // Q_OS_LINUX
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+
+#include <sys/socket.h>
+
+
+// Preallocated set of fixed-size receive buffers, filled by one recvmmsg()
+// call. Nothing is allocated while receiving and the datagrams are parsed
+// directly in the buffers they were received into.
+//
+// Each buffer has room for the ancillary data the kernel attaches when
+// SO_TIMESTAMPNS and SO_RXQ_OVFL are enabled on the socket, which the
+// static helpers open and set up.
+class DatagramBatch
+{
+public:
+    enum {
+        Capacity = 64,
+        BufferSize = 2048,
+        ControlSize = 128
+    };
+
+    static int openSocket(quint16 port, bool shared);
+    static bool enableTimestamps(int fd);
+    static bool enableDropCount(int fd);
+
+    DatagramBatch();
+    DatagramBatch(const DatagramBatch &) = delete;
+    DatagramBatch &operator=(const DatagramBatch &) = delete;
+
+    // Returns the number of datagrams received (0 if none was pending),
+    // or -1 on error.
+    int receive(int fd);
+
+    const char *data(int i) const { return m_buffers[i]; }
+    int size(int i) const { return int(m_messages[i].msg_len); }
+    bool truncated(int i) const { return m_messages[i].msg_hdr.msg_flags & MSG_TRUNC; }
+    // Kernel arrival time in SensorClock nanoseconds, 0 if not available.
+    qint64 arrivalTime(int i) const;
+    // Number of datagrams the kernel has dropped on this socket so far,
+    // as of datagram i. Returns false if not available.
+    bool dropCount(int i, quint32 *count) const;
+    // Source address of datagram i, to send a reply to.
+    const sockaddr *address(int i) const { return reinterpret_cast<const sockaddr *>(&m_addresses[i]); }
+    socklen_t addressLength(int i) const { return m_messages[i].msg_hdr.msg_namelen; }
+
+private:
+    const void *controlData(int i, int type) const;
+
+    mmsghdr m_messages[Capacity];
+    iovec m_iovecs[Capacity];
+    sockaddr_storage m_addresses[Capacity];
+    alignas(cmsghdr) char m_control[Capacity][ControlSize];
+    alignas(64) char m_buffers[Capacity][BufferSize];
+};
+
+#endif // Q_OS_LINUX
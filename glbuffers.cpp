@@ -49,6 +49,7 @@
 ****************************************************************************/
 
 #include "glbuffers.h"
+#include "hotlog.h"
 
 void qgluPerspective(GLdouble fovy, GLdouble aspect, GLdouble zNear, GLdouble zFar)
 {
@@ -364,7 +365,7 @@ void GLRenderTargetCube::end()
 void GLRenderTargetCube::getViewMatrix(QMatrix4x4& mat, int face)
 {
     if (face < 0 || face >= 6) {
-        qWarning("GLRenderTargetCube::getViewMatrix: 'face' must be in the range [0, 6). (face == %d)", face);
+        HotLog::log(HotLog::BadCubemapFace, face);
         return;
     }
 
@@ -0,0 +1,214 @@
+#include "hotlog.h"
+#include "sensorclock.h"
+#include "sensorstatistics.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+
+namespace
+{
+    enum Argument {
+        None,
+        Number,
+        Error
+    };
+
+    struct Format
+    {
+        QtMsgType type;
+        Argument argument;
+        const char *text;
+        // What the summary of suppressed messages is about.
+        const char *subject;
+    };
+
+    const Format Formats[HotLog::MessageCount] = {
+        { QtDebugMsg, Number, "Malformed sensor packet of %lld bytes",
+          "malformed sensor packets" },
+        { QtDebugMsg, Number, "Unsupported sensor protocol version %lld",
+          "unsupported sensor protocol versions" },
+        { QtDebugMsg, Number, "Sensor ID out of range: %lld",
+          "sensor IDs out of range" },
+        { QtDebugMsg, Number, "Malformed time request of %lld bytes",
+          "malformed time requests" },
+        { QtDebugMsg, None, "Truncated sensor packet",
+          "truncated sensor packets" },
+        { QtDebugMsg, None, "Corrupt sensor frame",
+          "corrupt sensor frames" },
+        { QtWarningMsg, Number, "Shared-memory ring claimed %lld packets; skipped them",
+          "corrupt shared-memory rings" },
+        { QtDebugMsg, Error, "Unable to answer time request: %s",
+          "unanswered time requests" },
+        { QtDebugMsg, Error, "Unable to subscribe to the relay: %s",
+          "failed relay subscriptions" },
+        { QtWarningMsg, Error, "recvmmsg failed: %s",
+          "recvmmsg failures" },
+        { QtWarningMsg, None, "Too many relay subscribers",
+          "refused relay subscribers" },
+        { QtWarningMsg, None, "Too many local sensor connections",
+          "refused local sensor connections" },
+        { QtWarningMsg, Number,
+          "GLRenderTargetCube::getViewMatrix: 'face' must be in the range [0, 6). (face == %lld)",
+          "invalid cubemap faces" }
+    };
+
+    struct Record
+    {
+        qint64 argument;
+        quint32 message;
+    };
+
+    // Single-producer, single-consumer queue of one thread's records,
+    // followed by its rate limiting state and its counters of records
+    // that never made it into the queue. Rings outlive their threads.
+    struct Ring
+    {
+        std::atomic<quint32> head{0};
+        std::atomic<quint32> tail{0};
+        Record records[HotLog::RingCapacity];
+        // Producer only.
+        qint64 windowStart[HotLog::MessageCount] = {};
+        int windowCount[HotLog::MessageCount] = {};
+        StatisticsCounter suppressed[HotLog::MessageCount];
+        StatisticsCounter lost;
+        // Writer only: how much of the counters it has summarized.
+        quint64 reportedSuppressed[HotLog::MessageCount] = {};
+        quint64 reportedLost = 0;
+        Ring *next = nullptr;
+    };
+}
+
+
+// How often the Writer looks at the rings, and how often it summarizes,
+// in milliseconds and nanoseconds.
+static const int FlushInterval = 100;
+static const qint64 SummaryInterval = 1000000000;
+
+static std::atomic<Ring *> rings{nullptr};
+static thread_local Ring *threadRing = nullptr;
+
+
+static void
+write(QtMsgType type, const char *text) {
+    if (type == QtWarningMsg)
+        qWarning("%s", text);
+    else
+        qDebug("%s", text);
+}
+
+
+//============================================================================//
+//                                   HotLog                                   //
+//============================================================================//
+
+void
+HotLog::log(Message message, qint64 argument) {
+    Ring *ring = threadRing;
+    if (!ring) {
+        ring = threadRing = new Ring;
+        ring->next = rings.load(std::memory_order_relaxed);
+        while (!rings.compare_exchange_weak(ring->next, ring, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+        }
+    }
+    const qint64 now = SensorClock::now();
+    if (now - ring->windowStart[message] >= 1000000000) {
+        ring->windowStart[message] = now;
+        ring->windowCount[message] = 0;
+    }
+    if (ring->windowCount[message] == RateLimit) {
+        ring->suppressed[message].add();
+        return;
+    }
+    ++ring->windowCount[message];
+    const quint32 head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) == RingCapacity) {
+        ring->lost.add();
+        return;
+    }
+    Record &record = ring->records[head % RingCapacity];
+    record.argument = argument;
+    record.message = quint32(message);
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+
+HotLog::Writer::Writer(QObject *parent)
+    : QThread(parent)
+{
+    setObjectName(QStringLiteral("Log writer"));
+}
+
+
+HotLog::Writer::~Writer() {
+    requestInterruption();
+    wait();
+    flush(true);
+}
+
+
+void
+HotLog::Writer::run() {
+    qint64 lastSummary = SensorClock::now();
+    while (!isInterruptionRequested()) {
+        msleep(FlushInterval);
+        const qint64 now = SensorClock::now();
+        const bool summarize = now - lastSummary >= SummaryInterval;
+        if (summarize)
+            lastSummary = now;
+        flush(summarize);
+    }
+}
+
+
+// Writes the records queued so far and, if summarize, how many were
+// suppressed or lost since the last summary, all threads together.
+void
+HotLog::Writer::flush(bool summarize) {
+    char text[256];
+    quint64 suppressed[MessageCount] = {};
+    quint64 lost = 0;
+    for (Ring *ring = rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        const quint32 head = ring->head.load(std::memory_order_acquire);
+        quint32 tail = ring->tail.load(std::memory_order_relaxed);
+        for (; tail != head; ++tail) {
+            const Record &record = ring->records[tail % RingCapacity];
+            const Format &format = Formats[record.message];
+            switch (format.argument) {
+            case None:
+                write(format.type, format.text);
+                break;
+            case Number:
+                snprintf(text, sizeof(text), format.text, static_cast<long long>(record.argument));
+                write(format.type, text);
+                break;
+            case Error:
+                snprintf(text, sizeof(text), format.text, strerror(int(record.argument)));
+                write(format.type, text);
+                break;
+            }
+        }
+        ring->tail.store(tail, std::memory_order_release);
+        if (!summarize)
+            continue;
+        for (int i = 0; i < MessageCount; ++i) {
+            const quint64 value = ring->suppressed[i].value();
+            suppressed[i] += value - ring->reportedSuppressed[i];
+            ring->reportedSuppressed[i] = value;
+        }
+        const quint64 value = ring->lost.value();
+        lost += value - ring->reportedLost;
+        ring->reportedLost = value;
+    }
+    for (int i = 0; i < MessageCount; ++i) {
+        if (suppressed[i]) {
+            snprintf(text, sizeof(text), "Suppressed %llu more messages about %s",
+                     suppressed[i], Formats[i].subject);
+            write(Formats[i].type, text);
+        }
+    }
+    if (lost)
+        qWarning("Lost %llu log messages to full rings", lost);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QThread>
+
+
+// Logging for the ingest and render threads, which must never wait on
+// formatting, a lock or a terminal.
+//
+// log() only appends a small binary record, the message and one integer
+// argument, to a ring owned by the calling thread; a Writer thread formats
+// the records and hands them to Qt's message handler. Each thread may log
+// each message at most RateLimit times a second; the rest are counted and
+// summarized by the Writer once a second, as are records lost to a full
+// ring. The first message a thread logs allocates its ring.
+namespace HotLog
+{
+    enum {
+        RateLimit = 10,
+        RingCapacity = 256
+    };
+
+    enum Message {
+        MalformedPacket,        // argument: size in bytes
+        UnsupportedVersion,     // argument: version
+        UnknownSensor,          // argument: sensor ID
+        MalformedTimeRequest,   // argument: size in bytes
+        TruncatedPacket,
+        CorruptFrame,
+        CorruptRing,            // argument: packets the ring claimed to hold
+        TimeReplyFailed,        // argument: errno
+        SubscriptionFailed,     // argument: errno
+        ReceiveFailed,          // argument: errno
+        TooManySubscribers,
+        TooManyLocalConnections,
+        BadCubemapFace,         // argument: face
+        MessageCount
+    };
+
+    void log(Message message, qint64 argument = 0);
+
+    // Writes what the threads log for as long as it runs, and whatever is
+    // left when it is destroyed. Only one may exist at a time.
+    class Writer : public QThread
+    {
+        Q_OBJECT
+    public:
+        explicit Writer(QObject *parent = nullptr);
+        ~Writer();
+
+    protected:
+        void run() override;
+
+    private:
+        void flush(bool summarize);
+    };
+}
@@ -0,0 +1,204 @@
+#include "imufusion.h"
+
+#include <cmath>
+
+
+//============================================================================//
+//                                  ImuFusion                                 //
+//============================================================================//
+
+// Filter gain in radians per second: how fast orientation errors are
+// corrected, at the price of letting more accelerometer noise through.
+// Madgwick suggests about the gyroscope's measurement error.
+static const float Gain = 0.1f;
+// A much larger gain for the first StartupTime of a stream, so that it
+// converges from the identity within a fraction of a second.
+static const float StartupGain = 2.5f;
+static const qint64 StartupTime = 1000000000;
+// Gaps longer than this mean the stream stalled, so converge again.
+static const qint64 MaximumInterval = 1000000000;
+// Never integrate the angular rate over more than this, in seconds.
+static const float MaximumStep = 0.1f;
+// Keeps reciprocal square roots finite for zero vectors without a branch.
+static const float Tiny = 1.0e-30f;
+
+
+ImuFusion::ImuFusion() {
+    for (int i = 0; i < Capacity; ++i) {
+        m_q0[i] = 1.0f;
+        m_q1[i] = m_q2[i] = m_q3[i] = 0.0f;
+        m_lastTime[i] = m_startTime[i] = 0;
+        m_started[i] = false;
+        m_queued[i] = false;
+    }
+}
+
+
+void
+ImuFusion::update(SensorSample *samples, const SensorProtocol::ImuReading *readings, int count) {
+    int lanes = 0;
+    for (int i = 0; i < count; ++i) {
+        const SensorSample &sample = samples[i];
+        const int id = sample.sensorId;
+        // Out of range IDs are counted when the sample is published.
+        if (!sample.fused || id >= Capacity)
+            continue;
+        // A second sample of the same sensor depends on the first.
+        if (m_queued[id]) {
+            step(samples, lanes);
+            lanes = 0;
+        }
+        const qint64 interval = sample.senderTime - m_lastTime[id];
+        if (m_started[id] && interval <= 0) {
+            // Not newer than the last reading: it takes the current
+            // orientation and leaves the filter alone.
+            samples[i].w = m_q0[id];
+            samples[i].x = m_q1[id];
+            samples[i].y = m_q2[id];
+            samples[i].z = m_q3[id];
+            continue;
+        }
+        if (!m_started[id] || interval > MaximumInterval) {
+            m_started[id] = true;
+            m_startTime[id] = sample.senderTime;
+            m_batch.dt[lanes] = 0.0f;
+        } else {
+            m_batch.dt[lanes] = qMin(interval * 1.0e-9f, MaximumStep);
+        }
+        m_lastTime[id] = sample.senderTime;
+        m_batch.gain[lanes] = sample.senderTime - m_startTime[id] < StartupTime ? StartupGain : Gain;
+
+        const SensorProtocol::ImuReading &reading = readings[i];
+        m_batch.gx[lanes] = reading.gyro[0];
+        m_batch.gy[lanes] = reading.gyro[1];
+        m_batch.gz[lanes] = reading.gyro[2];
+        m_batch.ax[lanes] = reading.accel[0];
+        m_batch.ay[lanes] = reading.accel[1];
+        m_batch.az[lanes] = reading.accel[2];
+        m_batch.mx[lanes] = reading.magnet[0];
+        m_batch.my[lanes] = reading.magnet[1];
+        m_batch.mz[lanes] = reading.magnet[2];
+        m_batch.q0[lanes] = m_q0[id];
+        m_batch.q1[lanes] = m_q1[id];
+        m_batch.q2[lanes] = m_q2[id];
+        m_batch.q3[lanes] = m_q3[id];
+        m_batch.sample[lanes] = i;
+        m_queued[id] = true;
+        ++lanes;
+    }
+    step(samples, lanes);
+}
+
+
+// One filter update of the first lanes lanes, then their results are
+// scattered back to the sensor state and the samples.
+void
+ImuFusion::step(SensorSample *samples, int lanes) {
+    if (lanes == 0)
+        return;
+    // Round up to a multiple of 8 lanes with inert ones, so that the loop
+    // below needs no scalar remainder.
+    const int padded = (lanes + 7) & ~7;
+    for (int j = lanes; j < padded; ++j) {
+        m_batch.gx[j] = m_batch.gy[j] = m_batch.gz[j] = 0.0f;
+        m_batch.ax[j] = m_batch.ay[j] = m_batch.az[j] = 0.0f;
+        m_batch.mx[j] = m_batch.my[j] = m_batch.mz[j] = 0.0f;
+        m_batch.dt[j] = m_batch.gain[j] = 0.0f;
+        m_batch.q0[j] = 1.0f;
+        m_batch.q1[j] = m_batch.q2[j] = m_batch.q3[j] = 0.0f;
+    }
+
+    Batch &b = m_batch;
+    for (int j = 0; j < padded; ++j) {
+        const float q0 = b.q0[j], q1 = b.q1[j], q2 = b.q2[j], q3 = b.q3[j];
+        const float gx = b.gx[j], gy = b.gy[j], gz = b.gz[j];
+
+        // Rate of change of the orientation from the gyroscope.
+        float qDot0 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+        float qDot1 = 0.5f * ( q0 * gx + q2 * gz - q3 * gy);
+        float qDot2 = 0.5f * ( q0 * gy - q1 * gz + q3 * gx);
+        float qDot3 = 0.5f * ( q0 * gz + q1 * gy - q2 * gx);
+
+        // Normalized measurements. Without an accelerometer reading there
+        // is no correction at all; without a magnetometer reading the
+        // field terms below all vanish and only gravity is corrected for.
+        float ax = b.ax[j], ay = b.ay[j], az = b.az[j];
+        const float accelNorm = ax * ax + ay * ay + az * az;
+        const float accelValid = accelNorm > 0.0f ? 1.0f : 0.0f;
+        const float accelScale = 1.0f / std::sqrt(accelNorm + Tiny);
+        ax *= accelScale; ay *= accelScale; az *= accelScale;
+        float mx = b.mx[j], my = b.my[j], mz = b.mz[j];
+        const float magnetScale = 1.0f / std::sqrt(mx * mx + my * my + mz * mz + Tiny);
+        mx *= magnetScale; my *= magnetScale; mz *= magnetScale;
+
+        const float _2q0mx = 2.0f * q0 * mx;
+        const float _2q0my = 2.0f * q0 * my;
+        const float _2q0mz = 2.0f * q0 * mz;
+        const float _2q1mx = 2.0f * q1 * mx;
+        const float _2q0 = 2.0f * q0;
+        const float _2q1 = 2.0f * q1;
+        const float _2q2 = 2.0f * q2;
+        const float _2q3 = 2.0f * q3;
+        const float _2q0q2 = 2.0f * q0 * q2;
+        const float _2q2q3 = 2.0f * q2 * q3;
+        const float q0q0 = q0 * q0, q0q1 = q0 * q1, q0q2 = q0 * q2, q0q3 = q0 * q3;
+        const float q1q1 = q1 * q1, q1q2 = q1 * q2, q1q3 = q1 * q3;
+        const float q2q2 = q2 * q2, q2q3 = q2 * q3, q3q3 = q3 * q3;
+
+        // Direction of the Earth's magnetic field in the Earth frame.
+        const float hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2
+                       + _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
+        const float hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1
+                       + my * q2q2 + _2q2 * mz * q3 - my * q3q3;
+        const float _2bx = std::sqrt(hx * hx + hy * hy);
+        const float _2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1
+                         + _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
+        const float _4bx = 2.0f * _2bx;
+        const float _4bz = 2.0f * _2bz;
+
+        // Gradient of the objective function: the errors between the
+        // measured and the predicted gravity and field directions.
+        const float fx = 2.0f * q1q3 - _2q0q2 - ax;
+        const float fy = 2.0f * q0q1 + _2q2q3 - ay;
+        const float fz = 1.0f - 2.0f * q1q1 - 2.0f * q2q2 - az;
+        const float bx = _2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx;
+        const float by = _2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my;
+        const float bz = _2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz;
+        float s0 = -_2q2 * fx + _2q1 * fy - _2bz * q2 * bx
+                 + (-_2bx * q3 + _2bz * q1) * by + _2bx * q2 * bz;
+        float s1 = _2q3 * fx + _2q0 * fy - 4.0f * q1 * fz + _2bz * q3 * bx
+                 + (_2bx * q2 + _2bz * q0) * by + (_2bx * q3 - _4bz * q1) * bz;
+        float s2 = -_2q0 * fx + _2q3 * fy - 4.0f * q2 * fz + (-_4bx * q2 - _2bz * q0) * bx
+                 + (_2bx * q1 + _2bz * q3) * by + (_2bx * q0 - _4bz * q2) * bz;
+        float s3 = _2q1 * fx + _2q2 * fy + (-_4bx * q3 + _2bz * q1) * bx
+                 + (-_2bx * q0 + _2bz * q2) * by + _2bx * q1 * bz;
+        const float step = accelValid * b.gain[j]
+                         / std::sqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3 + Tiny);
+        qDot0 -= step * s0;
+        qDot1 -= step * s1;
+        qDot2 -= step * s2;
+        qDot3 -= step * s3;
+
+        // Integrate and renormalize.
+        const float dt = b.dt[j];
+        const float r0 = q0 + qDot0 * dt;
+        const float r1 = q1 + qDot1 * dt;
+        const float r2 = q2 + qDot2 * dt;
+        const float r3 = q3 + qDot3 * dt;
+        const float scale = 1.0f / std::sqrt(r0 * r0 + r1 * r1 + r2 * r2 + r3 * r3 + Tiny);
+        b.q0[j] = r0 * scale;
+        b.q1[j] = r1 * scale;
+        b.q2[j] = r2 * scale;
+        b.q3[j] = r3 * scale;
+    }
+
+    for (int j = 0; j < lanes; ++j) {
+        SensorSample &sample = samples[m_batch.sample[j]];
+        const int id = sample.sensorId;
+        m_q0[id] = sample.w = m_batch.q0[j];
+        m_q1[id] = sample.x = m_batch.q1[j];
+        m_q2[id] = sample.y = m_batch.q2[j];
+        m_q3[id] = sample.z = m_batch.q3[j];
+        m_queued[id] = false;
+    }
+}
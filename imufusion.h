@@ -0,0 +1,70 @@
+#pragma once
+
+#include "sensorprotocol.h"
+#include "sensorsample.h"
+#include "sensortable.h"
+
+
+// Fuses the orientation of sensors that only send raw IMU readings, with
+// Madgwick's gradient-descent AHRS filter (gyroscope integration corrected
+// towards gravity and, when the sensor has one, magnetic north).
+//
+// The filter state of every sensor is kept in structure-of-arrays form and
+// the samples of a packet are gathered into lanes and updated together by
+// one branch-free loop the compiler vectorizes, so fusing many sensors at
+// a high rate costs little more than parsing them. Each input thread's
+// PacketHandler owns its own ImuFusion, so a raw sensor should be sent over
+// one input only.
+class ImuFusion
+{
+public:
+    enum { Capacity = SensorTable::Capacity };
+
+    ImuFusion();
+    ImuFusion(const ImuFusion &) = delete;
+    ImuFusion &operator=(const ImuFusion &) = delete;
+
+    // Fuses the orientation of the samples flagged fused among count, in
+    // order, from their readings. A sample whose sender time is not newer
+    // than the last one of its sensor takes the current orientation
+    // without updating the filter.
+    void update(SensorSample *samples, const SensorProtocol::ImuReading *readings, int count);
+
+private:
+    // A multiple of any vector width, and room for a whole packet.
+    enum { Lanes = SensorProtocol::MaxSamples + 1 };
+
+    void step(SensorSample *samples, int lanes);
+
+    // Per sensor filter state.
+    alignas(64) float m_q0[Capacity];
+    alignas(64) float m_q1[Capacity];
+    alignas(64) float m_q2[Capacity];
+    alignas(64) float m_q3[Capacity];
+    qint64 m_lastTime[Capacity];
+    qint64 m_startTime[Capacity];
+    bool m_started[Capacity];
+    bool m_queued[Capacity];
+
+    // The lanes of the batch being updated.
+    struct Batch
+    {
+        alignas(64) float gx[Lanes];
+        alignas(64) float gy[Lanes];
+        alignas(64) float gz[Lanes];
+        alignas(64) float ax[Lanes];
+        alignas(64) float ay[Lanes];
+        alignas(64) float az[Lanes];
+        alignas(64) float mx[Lanes];
+        alignas(64) float my[Lanes];
+        alignas(64) float mz[Lanes];
+        alignas(64) float dt[Lanes];
+        alignas(64) float gain[Lanes];
+        alignas(64) float q0[Lanes];
+        alignas(64) float q1[Lanes];
+        alignas(64) float q2[Lanes];
+        alignas(64) float q3[Lanes];
+        int sample[Lanes];
+    };
+    Batch m_batch;
+};
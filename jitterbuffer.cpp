@@ -0,0 +1,74 @@
+#include "jitterbuffer.h"
+
+
+//============================================================================//
+//                                JitterBuffer                                //
+//============================================================================//
+
+JitterBuffer::JitterBuffer()
+    : m_head(0)
+{
+}
+
+
+// Single producer only.
+void
+JitterBuffer::push(const SensorSample &sample) {
+    const quint32 head = m_head.load(std::memory_order_relaxed);
+    m_entries[head % Capacity].store(sample);
+    m_head.store(head + 1, std::memory_order_release);
+}
+
+
+// Loads the sample pushed as number index, failing if the writer has
+// started to reuse its entry.
+bool
+JitterBuffer::load(quint32 index, SensorSample *sample) const {
+    if (!m_entries[index % Capacity].load(sample))
+        return false;
+    return m_head.load(std::memory_order_acquire) - index < Capacity;
+}
+
+
+bool
+JitterBuffer::latest(SensorSample *sample) const {
+    const quint32 head = m_head.load(std::memory_order_acquire);
+    return head != 0 && load(head - 1, sample);
+}
+
+
+// Times after the newest sample hold the newest orientation, times before
+// the oldest one still in the buffer hold the oldest.
+bool
+JitterBuffer::interpolate(qint64 time, Interpolation *result) const {
+    const quint32 head = m_head.load(std::memory_order_acquire);
+    if (head == 0)
+        return false;
+    const quint32 oldest = head > Capacity ? head - Capacity + 1 : 0;
+    SensorSample newer;
+    if (!load(head - 1, &newer))
+        return false;
+    result->ahead = 0;
+    if (newer.sampleTime <= time) {
+        result->from = result->to = newer;
+        result->t = 0.0f;
+        result->ahead = time - newer.sampleTime;
+        return true;
+    }
+    for (quint32 index = head - 1; index-- > oldest; ) {
+        SensorSample older;
+        if (!load(index, &older))
+            break;
+        if (older.sampleTime <= time) {
+            const qint64 span = newer.sampleTime - older.sampleTime;
+            result->from = older;
+            result->to = newer;
+            result->t = span > 0 ? float(double(time - older.sampleTime) / span) : 1.0f;
+            return true;
+        }
+        newer = older;
+    }
+    result->from = result->to = newer;
+    result->t = 0.0f;
+    return true;
+}
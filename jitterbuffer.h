@@ -0,0 +1,44 @@
+#pragma once
+
+#include "seqlock.h"
+#include "sensorsample.h"
+
+#include <atomic>
+
+
+// Short time-indexed history of the samples of one sensor stream.
+//
+// The ingest thread push()es samples as they arrive; the render thread asks
+// for the orientation at a given time, usually "now minus the playout
+// delay", and gets the two samples around it so that bursty arrivals can be
+// smoothed out by interpolating between them. Both sides are lock-free:
+// every entry is a SeqLock and a reader that gets lapped by the writer just
+// reports failure.
+class JitterBuffer
+{
+public:
+    enum { Capacity = 32 };
+
+    // The orientation at a given time is slerp(from, to, t). For times
+    // after the newest sample from and to are both the newest and ahead is
+    // how far past it the requested time lies, in nanoseconds.
+    struct Interpolation
+    {
+        SensorSample from;
+        SensorSample to;
+        float t;
+        qint64 ahead;
+    };
+
+    JitterBuffer();
+
+    void push(const SensorSample &sample);
+    bool latest(SensorSample *sample) const;
+    bool interpolate(qint64 time, Interpolation *result) const;
+
+private:
+    bool load(quint32 index, SensorSample *sample) const;
+
+    std::atomic<quint32> m_head;
+    SeqLock<SensorSample> m_entries[Capacity];
+};
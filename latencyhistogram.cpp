@@ -0,0 +1,104 @@
+#include "latencyhistogram.h"
+
+#include <limits>
+
+
+//============================================================================//
+//                              LatencyHistogram                              //
+//============================================================================//
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+
+// Not atomic with respect to concurrent record() calls.
+void
+LatencyHistogram::reset() {
+    for (int i = 0; i < BucketCount; ++i)
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_minimum.store(std::numeric_limits<qint64>::max(), std::memory_order_relaxed);
+    m_maximum.store(0, std::memory_order_relaxed);
+}
+
+
+int
+LatencyHistogram::bucketIndex(quint64 microseconds) {
+    if (microseconds < SubBuckets)
+        return int(microseconds);
+    const int exponent = 63 - __builtin_clzll(microseconds);
+    const int subBucket = int(microseconds >> (exponent - SubBucketBits)) & (SubBuckets - 1);
+    const int index = SubBuckets + (exponent - SubBucketBits) * SubBuckets + subBucket;
+    return qMin(index, BucketCount - 1);
+}
+
+
+quint64
+LatencyHistogram::bucketUpperBound(int index) {
+    if (index < SubBuckets)
+        return quint64(index) + 1;
+    const int exponent = (index - SubBuckets) / SubBuckets + SubBucketBits;
+    const int subBucket = (index - SubBuckets) % SubBuckets;
+    return (quint64(SubBuckets + subBucket + 1)) << (exponent - SubBucketBits);
+}
+
+
+void
+LatencyHistogram::record(qint64 nanoseconds) {
+    if (nanoseconds < 0)
+        nanoseconds = 0;
+    m_buckets[bucketIndex(quint64(nanoseconds) / 1000)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+    // Single recording thread, so plain compare-and-store is enough.
+    if (nanoseconds < m_minimum.load(std::memory_order_relaxed))
+        m_minimum.store(nanoseconds, std::memory_order_relaxed);
+    if (nanoseconds > m_maximum.load(std::memory_order_relaxed))
+        m_maximum.store(nanoseconds, std::memory_order_relaxed);
+}
+
+
+quint64
+LatencyHistogram::count() const {
+    return m_count.load(std::memory_order_relaxed);
+}
+
+
+qint64
+LatencyHistogram::minimum() const {
+    return count() ? m_minimum.load(std::memory_order_relaxed) : 0;
+}
+
+
+qint64
+LatencyHistogram::maximum() const {
+    return m_maximum.load(std::memory_order_relaxed);
+}
+
+
+qint64
+LatencyHistogram::mean() const {
+    const quint64 n = count();
+    return n ? m_sum.load(std::memory_order_relaxed) / qint64(n) : 0;
+}
+
+
+qint64
+LatencyHistogram::percentile(double fraction) const {
+    quint64 total = 0;
+    quint64 counts[BucketCount];
+    for (int i = 0; i < BucketCount; ++i)
+        total += (counts[i] = m_buckets[i].load(std::memory_order_relaxed));
+    if (total == 0)
+        return 0;
+    const quint64 target = qMax<quint64>(1, quint64(qBound(0.0, fraction, 1.0) * total + 0.5));
+    quint64 seen = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        seen += counts[i];
+        if (seen >= target)
+            return qMin(qint64(bucketUpperBound(i)) * 1000, maximum());
+    }
+    return maximum();
+}
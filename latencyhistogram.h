@@ -0,0 +1,45 @@
+#pragma once
+
+#include <QtGlobal>
+
+#include <atomic>
+
+
+// Log-linear histogram of latencies, recorded in nanoseconds and kept with
+// microsecond resolution: every power of two is split into eight buckets,
+// so any reported value is within 12.5% of the true one.
+//
+// record() is wait-free and may be called from one thread while any
+// other thread queries the histogram.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(qint64 nanoseconds);
+    void reset();
+
+    quint64 count() const;
+    qint64 minimum() const;
+    qint64 maximum() const;
+    qint64 mean() const;
+    // Upper bound of the bucket holding the given fraction (0..1) of the
+    // recorded values, in nanoseconds, never above maximum().
+    qint64 percentile(double fraction) const;
+
+private:
+    enum {
+        SubBucketBits = 3,
+        SubBuckets = 1 << SubBucketBits,
+        BucketCount = SubBuckets * 40
+    };
+
+    static int bucketIndex(quint64 microseconds);
+    static quint64 bucketUpperBound(int index);
+
+    std::atomic<quint64> m_buckets[BucketCount];
+    std::atomic<quint64> m_count;
+    std::atomic<qint64> m_sum;
+    std::atomic<qint64> m_minimum;
+    std::atomic<qint64> m_maximum;
+};
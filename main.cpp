@@ -49,6 +49,7 @@
 ****************************************************************************/
 
 #include "glextensions.h"
+#include "hotlog.h"
 #include "scene.h"
 #include "graphicsview.h"
 
@@ -94,9 +95,143 @@ necessaryExtensionsSupported() {
 }
 
 
+SensorOptions
+parseSensorOptions(const QCoreApplication &app) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Shows the orientation streamed by a remote sensor.");
+    parser.addHelpOption();
+
+    QCommandLineOption portOption("port",
+        "UDP port the sensor samples arrive on.", "port", "3333");
+    QCommandLineOption multicastOption("multicast",
+        "Also receive the sensor samples sent to the IPv4 or IPv6 multicast group <group>.", "group");
+    QCommandLineOption multicastInterfaceOption("multicast-interface",
+        "Join the multicast group on the network interface <name>.", "name");
+    QCommandLineOption allowOption("allow",
+        "Only accept sensor datagrams and relay subscriptions from the comma-separated "
+        "addresses and subnets <list>, such as 192.168.1.0/24,fd00::/8.", "list");
+    QCommandLineOption sourceRateOption("source-rate",
+        "Drop the datagrams of any source beyond <n> per second; 0 for no limit.", "n", "5000");
+    QCommandLineOption oscPortOption("osc-port",
+        "Also receive OSC messages such as /sensor/3/quat on UDP port <port>.", "port", "0");
+    QCommandLineOption playoutDelayOption("playout-delay",
+        "Draw the sensor <ms> milliseconds behind real time, interpolating between samples.", "ms", "0");
+    QCommandLineOption maxPredictionOption("max-prediction",
+        "Extrapolate the sensor up to <ms> milliseconds ahead to meet the display time of each frame.", "ms", "0");
+    QCommandLineOption alignRateOption("align-rate",
+        "Resample all sensors together onto a common timeline at <hz> frames per second and draw "
+        "those frames.", "hz", "0");
+    QCommandLineOption alignDelayOption("align-delay",
+        "Make each common frame <ms> milliseconds, at most 1000, after its time, once the samples "
+        "around it have arrived.", "ms", "20");
+    QCommandLineOption filterOption("filter",
+        "Smooth the sensors on ingest with the filter chain <chain>, such as oneeuro:1.5:0.05,deadband:0.2 "
+        "(lowpass:<ms>, oneeuro:<min cutoff Hz>[:<beta>], deadband:<degrees>).", "chain");
+    QCommandLineOption calibrationOption("calibration",
+        "Load and save the sensor tare and mounting calibrations in <file>.", "file",
+        QStandardPaths::writableLocation(QStandardPaths::AppConfigLocation)
+            + QStringLiteral("/calibration.ini"));
+    QCommandLineOption sharedMemoryOption("shm",
+        "Also read sensor packets from the shared-memory ring <name>, written by a local bridge.", "name");
+    QCommandLineOption localSocketOption("local",
+        "Also accept sensor packets from local producers on the Unix-domain socket <path>.", "path");
+    QCommandLineOption serialOption("serial",
+        "Also read COBS framed sensor packets from the serial device <device>.", "device");
+    QCommandLineOption serialBaudOption("serial-baud",
+        "Baud rate of the serial device.", "rate", "921600");
+    QCommandLineOption relayPortOption("relay-port",
+        "Forward the sensor samples to the viewers that subscribe on UDP port <port>.", "port", "0");
+    QCommandLineOption relayRateOption("relay-rate",
+        "Send relay subscribers at most <hz> updates per second.", "hz", "60");
+    QCommandLineOption subscribeOption("subscribe",
+        "Also receive the sensor samples of the relay at <host:port>.", "host:port");
+    QCommandLineOption recordOption("record",
+        "Record every accepted sensor sample to <file>.", "file");
+    QCommandLineOption ingestThreadsOption("ingest-threads",
+        "Receive on <n> threads sharing the UDP port, each serving its own subset of the senders.", "n", "1");
+    QCommandLineOption busyPollOption("busy-poll",
+        "Spin on the sensor socket instead of sleeping, for the lowest ingest latency; takes a whole core.");
+    QCommandLineOption ingestCpuOption("ingest-cpu",
+        "Pin the sensor ingest threads to CPU <cpu> and the following ones.", "cpu", "-1");
+    QCommandLineOption realtimeOption("realtime",
+        "Run the sensor ingest threads at SCHED_FIFO priority <priority> (1-99).", "priority", "0");
+    parser.addOption(portOption);
+    parser.addOption(multicastOption);
+    parser.addOption(multicastInterfaceOption);
+    parser.addOption(allowOption);
+    parser.addOption(sourceRateOption);
+    parser.addOption(oscPortOption);
+    parser.addOption(playoutDelayOption);
+    parser.addOption(maxPredictionOption);
+    parser.addOption(alignRateOption);
+    parser.addOption(alignDelayOption);
+    parser.addOption(filterOption);
+    parser.addOption(calibrationOption);
+    parser.addOption(sharedMemoryOption);
+    parser.addOption(localSocketOption);
+    parser.addOption(serialOption);
+    parser.addOption(serialBaudOption);
+    parser.addOption(relayPortOption);
+    parser.addOption(relayRateOption);
+    parser.addOption(subscribeOption);
+    parser.addOption(recordOption);
+    parser.addOption(ingestThreadsOption);
+    parser.addOption(busyPollOption);
+    parser.addOption(ingestCpuOption);
+    parser.addOption(realtimeOption);
+    parser.process(app);
+
+    SensorOptions options;
+    options.udpPort = parser.value(portOption).toUShort();
+    options.multicastGroup = parser.value(multicastOption);
+    options.multicastInterface = parser.value(multicastInterfaceOption);
+    QString allowError;
+    if (!AdmissionControl::parse(parser.value(allowOption), &options.allowedSources,
+                                 &allowError)) {
+        qCritical("Invalid allow-list: %s", qPrintable(allowError));
+        exit(1);
+    }
+    options.sourceRate = qMax(0, parser.value(sourceRateOption).toInt());
+    options.oscPort = parser.value(oscPortOption).toUShort();
+    options.playoutDelay = qMax(0, parser.value(playoutDelayOption).toInt());
+    options.maxPrediction = qMax(0, parser.value(maxPredictionOption).toInt());
+    options.alignRate = qBound(0, parser.value(alignRateOption).toInt(), 1000);
+    options.alignDelay = qBound(0, parser.value(alignDelayOption).toInt(),
+                                int(StreamAligner::MaxDelay));
+    if (!OrientationFilter::parse(parser.value(filterOption), &options.filters)) {
+        qCritical("Invalid filter chain: %s", qPrintable(parser.value(filterOption)));
+        exit(1);
+    }
+    options.calibrationFile = parser.value(calibrationOption);
+    options.sharedMemory = parser.value(sharedMemoryOption);
+    options.localSocket = parser.value(localSocketOption);
+    options.serialDevice = parser.value(serialOption);
+    options.serialBaudRate = parser.value(serialBaudOption).toInt();
+    options.relayPort = parser.value(relayPortOption).toUShort();
+    options.relayRate = qBound(1, parser.value(relayRateOption).toInt(), 1000);
+    if (parser.isSet(subscribeOption)) {
+        // Also splits [IPv6]:port.
+        const QUrl relay(QStringLiteral("udp://") + parser.value(subscribeOption));
+        if (!relay.isValid() || relay.host().isEmpty() || relay.port() <= 0) {
+            qCritical("Invalid relay address: %s", qPrintable(parser.value(subscribeOption)));
+            exit(1);
+        }
+        options.subscribeHost = relay.host();
+        options.subscribePort = quint16(relay.port());
+    }
+    options.recordFile = parser.value(recordOption);
+    options.ingestThreads = qBound(1, parser.value(ingestThreadsOption).toInt(), 64);
+    options.busyPoll = parser.isSet(busyPollOption);
+    options.ingestCpu = parser.value(ingestCpuOption).toInt();
+    options.realtimePriority = qMax(0, parser.value(realtimeOption).toInt());
+    return options;
+}
+
+
 int
 main(int argc, char **argv) {
     QApplication app(argc, argv);
+    const SensorOptions sensorOptions = parseSensorOptions(app);
 
     if ((QGLFormat::openGLVersionFlags() & QGLFormat::OpenGL_Version_1_5) == 0) {
         QMessageBox::critical(nullptr, "OpenGL features missing",
@@ -126,10 +261,15 @@ main(int argc, char **argv) {
         return -3;
     }
 
+    // Writes what the ingest and render threads log, until after the scene
+    // and its threads are gone
+    HotLog::Writer logWriter;
+    logWriter.start(QThread::LowPriority);
+
     // The current context must be set before calling Scene's constructor
     widget->makeCurrent();
     QSize size = qApp->screens()[0]->size();
-    Scene scene(size.width(), size.height(), maxTextureSize);
+    Scene scene(size.width(), size.height(), maxTextureSize, sensorOptions);
     GraphicsView view;
     view.setViewport(widget);
     view.setViewportUpdateMode(QGraphicsView::FullViewportUpdate);
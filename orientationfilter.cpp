@@ -0,0 +1,249 @@
+#include "orientationfilter.h"
+
+#include <QStringList>
+
+#include <cmath>
+
+
+//============================================================================//
+//                              OrientationFilter                             //
+//============================================================================//
+
+// Gaps longer than this mean the stream stalled, so start over.
+static const qint64 MaximumInterval = 1000000000;
+// Shortest step the angular speed is measured over, in seconds.
+static const float MinimumStep = 1.0e-4f;
+// Cutoff of the 1-euro filter's angular speed estimate, in Hz, as the
+// authors recommend.
+static const float SpeedCutoff = 1.0f;
+static const float TwoPi = 6.2831853f;
+// Keeps reciprocal square roots finite for zero vectors without a branch.
+static const float Tiny = 1.0e-30f;
+
+
+bool
+OrientationFilter::parse(const QString &spec, QVector<Stage> *stages) {
+    stages->clear();
+    if (spec.trimmed().isEmpty())
+        return true;
+    const QStringList items = spec.split(QLatin1Char(','));
+    for (const QString &item : items) {
+        const QStringList fields = item.trimmed().split(QLatin1Char(':'));
+        const QString name = fields.first().toLower();
+        QVector<float> values;
+        for (int i = 1; i < fields.size(); ++i) {
+            bool ok;
+            const float value = fields[i].toFloat(&ok);
+            if (!ok || value < 0.0f)
+                return false;
+            values.append(value);
+        }
+        Stage stage;
+        if (name == QLatin1String("lowpass") && values.size() == 1 && values[0] > 0.0f) {
+            stage.kind = Stage::LowPass;
+            stage.timeConstant = values[0] / 1000.0f;
+        } else if (name == QLatin1String("oneeuro") && (values.size() == 1 || values.size() == 2)
+                   && values[0] > 0.0f) {
+            stage.kind = Stage::OneEuro;
+            stage.minCutoff = values[0];
+            stage.beta = values.size() == 2 ? values[1] : 0.0f;
+        } else if (name == QLatin1String("deadband") && values.size() == 1) {
+            stage.kind = Stage::Deadband;
+            stage.threshold = values[0] * TwoPi / 360.0f;
+        } else {
+            return false;
+        }
+        stages->append(stage);
+    }
+    return true;
+}
+
+
+OrientationFilter::OrientationFilter()
+    : m_stageCount(0)
+{
+    for (int i = 0; i < Capacity; ++i) {
+        for (int k = 0; k < MaxStages; ++k) {
+            m_state[k].q0[i] = 1.0f;
+            m_state[k].q1[i] = m_state[k].q2[i] = m_state[k].q3[i] = 0.0f;
+            m_state[k].speed[i] = 0.0f;
+        }
+        m_lastTime[i] = 0;
+        m_started[i] = false;
+        m_queued[i] = false;
+    }
+}
+
+
+void
+OrientationFilter::setStages(const QVector<Stage> &stages) {
+    m_stageCount = qMin(stages.size(), int(MaxStages));
+    for (int i = 0; i < m_stageCount; ++i)
+        m_stages[i] = stages[i];
+}
+
+
+void
+OrientationFilter::update(SensorSample *samples, int count) {
+    if (m_stageCount == 0)
+        return;
+    int lanes = 0;
+    for (int i = 0; i < count; ++i) {
+        SensorSample &sample = samples[i];
+        // Accepted samples all have IDs in range.
+        const int id = sample.sensorId;
+        // A second sample of the same sensor depends on the first.
+        if (m_queued[id]) {
+            step(samples, lanes);
+            lanes = 0;
+        }
+        const qint64 interval = sample.sampleTime - m_lastTime[id];
+        if (m_started[id] && interval < 0) {
+            // Too late to be filtered: it gets the current output.
+            const State &output = m_state[m_stageCount - 1];
+            sample.w = output.q0[id];
+            sample.x = output.q1[id];
+            sample.y = output.q2[id];
+            sample.z = output.q3[id];
+            continue;
+        }
+        const bool fresh = !m_started[id] || interval > MaximumInterval;
+        m_started[id] = true;
+        m_lastTime[id] = sample.sampleTime;
+        m_batch.fresh[lanes] = fresh ? 1.0f : 0.0f;
+        m_batch.dt[lanes] = fresh ? MinimumStep : qMax(interval * 1.0e-9f, MinimumStep);
+        m_batch.q0[lanes] = sample.w;
+        m_batch.q1[lanes] = sample.x;
+        m_batch.q2[lanes] = sample.y;
+        m_batch.q3[lanes] = sample.z;
+        m_batch.sample[lanes] = i;
+        m_queued[id] = true;
+        ++lanes;
+    }
+    step(samples, lanes);
+}
+
+
+// One stage over padded lanes: from the state in s and the input in q,
+// the new state, which is also the output, into both. Kind is a template
+// parameter so that the loop has no branch left to keep the compiler from
+// vectorizing it.
+template<int Kind>
+void
+OrientationFilter::filterLanes(Batch *batch, const Stage &stage, int padded) {
+    Batch &b = *batch;
+    const float timeConstant = stage.timeConstant;
+    const float minCutoff = stage.minCutoff;
+    const float beta = stage.beta;
+    const float threshold = std::sin(0.5f * stage.threshold);
+    const float speedTime = 1.0f / (TwoPi * SpeedCutoff);
+    for (int j = 0; j < padded; ++j) {
+        // The input on the same hemisphere as the state.
+        const float dot = b.s0[j] * b.q0[j] + b.s1[j] * b.q1[j]
+                        + b.s2[j] * b.q2[j] + b.s3[j] * b.q3[j];
+        const float sign = dot < 0.0f ? -1.0f : 1.0f;
+        const float i0 = sign * b.q0[j], i1 = sign * b.q1[j];
+        const float i2 = sign * b.q2[j], i3 = sign * b.q3[j];
+        // Sine of half the angle between them.
+        const float cosine = sign * dot;
+        // Rounding can take this slightly below zero; clamped without a
+        // branch, like everything in this loop.
+        const float square = 1.0f - cosine * cosine;
+        const float sine = std::sqrt(0.5f * (square + std::fabs(square)));
+        const float dt = b.dt[j];
+        const float fresh = b.fresh[j];
+
+        // How far to move from the state towards the input.
+        float t;
+        if (Kind == Stage::LowPass) {
+            t = dt / (dt + timeConstant);
+        } else if (Kind == Stage::OneEuro) {
+            const float rate = (1.0f - fresh) * 2.0f * sine / dt;
+            const float speed = b.speed[j] + dt / (dt + speedTime) * (rate - b.speed[j]);
+            b.speed[j] = speed;
+            const float cutoff = minCutoff + beta * speed;
+            t = dt / (dt + 1.0f / (TwoPi * cutoff));
+        } else {
+            // The part of the step beyond the threshold, or none.
+            const float excess = sine - threshold;
+            t = 0.5f * (excess + std::fabs(excess)) / (sine + Tiny);
+        }
+        // All the way on a fresh start.
+        t += fresh * (1.0f - t);
+
+        const float r0 = b.s0[j] + t * (i0 - b.s0[j]);
+        const float r1 = b.s1[j] + t * (i1 - b.s1[j]);
+        const float r2 = b.s2[j] + t * (i2 - b.s2[j]);
+        const float r3 = b.s3[j] + t * (i3 - b.s3[j]);
+        const float scale = 1.0f / std::sqrt(r0 * r0 + r1 * r1 + r2 * r2 + r3 * r3 + Tiny);
+        b.q0[j] = b.s0[j] = r0 * scale;
+        b.q1[j] = b.s1[j] = r1 * scale;
+        b.q2[j] = b.s2[j] = r2 * scale;
+        b.q3[j] = b.s3[j] = r3 * scale;
+    }
+}
+
+
+// Runs the first lanes lanes through every stage, each stage gathering its
+// state, updating all lanes at once and scattering its state back; then
+// the results go to the samples.
+void
+OrientationFilter::step(SensorSample *samples, int lanes) {
+    if (lanes == 0)
+        return;
+    // Round up to a multiple of 8 lanes with inert ones, so that the loops
+    // below need no scalar remainder.
+    const int padded = (lanes + 7) & ~7;
+    Batch &b = m_batch;
+    for (int j = lanes; j < padded; ++j) {
+        b.q0[j] = b.s0[j] = 1.0f;
+        b.q1[j] = b.q2[j] = b.q3[j] = 0.0f;
+        b.s1[j] = b.s2[j] = b.s3[j] = 0.0f;
+        b.speed[j] = 0.0f;
+        b.dt[j] = MinimumStep;
+        b.fresh[j] = 1.0f;
+    }
+
+    for (int k = 0; k < m_stageCount; ++k) {
+        const Stage &stage = m_stages[k];
+        State &state = m_state[k];
+        for (int j = 0; j < lanes; ++j) {
+            const int id = samples[b.sample[j]].sensorId;
+            b.s0[j] = state.q0[id];
+            b.s1[j] = state.q1[id];
+            b.s2[j] = state.q2[id];
+            b.s3[j] = state.q3[id];
+            b.speed[j] = state.speed[id];
+        }
+
+        switch (stage.kind) {
+        case Stage::LowPass:
+            filterLanes<Stage::LowPass>(&b, stage, padded);
+            break;
+        case Stage::OneEuro:
+            filterLanes<Stage::OneEuro>(&b, stage, padded);
+            break;
+        case Stage::Deadband:
+            filterLanes<Stage::Deadband>(&b, stage, padded);
+            break;
+        }
+
+        for (int j = 0; j < lanes; ++j) {
+            const int id = samples[b.sample[j]].sensorId;
+            state.q0[id] = b.s0[j];
+            state.q1[id] = b.s1[j];
+            state.q2[id] = b.s2[j];
+            state.q3[id] = b.s3[j];
+            state.speed[id] = b.speed[j];
+        }
+    }
+
+    for (int j = 0; j < lanes; ++j) {
+        SensorSample &sample = samples[b.sample[j]];
+        sample.w = b.q0[j];
+        sample.x = b.q1[j];
+        sample.y = b.q2[j];
+        sample.z = b.q3[j];
+        m_queued[sample.sensorId] = false;
+    }
+}
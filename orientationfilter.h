@@ -0,0 +1,117 @@
+#pragma once
+
+#include "sensorprotocol.h"
+#include "sensorsample.h"
+#include "sensortable.h"
+
+#include <QString>
+#include <QVector>
+
+
+// Smooths the orientation of every sensor on ingest with a configurable
+// chain of filters, each one taking the output of the one before:
+//
+//  - LowPass: exponential low-pass on the quaternion sphere, with a time
+//    constant; lags about that much behind.
+//  - OneEuro: the 1-euro filter of Casiez et al., a low-pass whose cutoff
+//    rises with the angular speed, so that it smooths the jitter of a
+//    sensor held still and adds little lag to a moving one.
+//  - Deadband: holds the orientation until the sensor turns further than a
+//    threshold away from it, then follows it that far behind.
+//
+// All filters interpolate along the shorter arc with normalized linear
+// interpolation, close enough to slerp at the small steps between two
+// samples. Like ImuFusion, the state of every sensor is kept in
+// structure-of-arrays form and the samples of a packet are gathered into
+// lanes that each stage updates together in a branch-free loop the
+// compiler vectorizes. Only samples SensorTable::admit() accepted are
+// filtered, in the order of their sampleTime: a sample older than the last
+// one filtered of its stream leaves the filters alone and takes their
+// current output. The first sample of a stream, or the first after a gap,
+// resets its filters.
+class OrientationFilter
+{
+public:
+    enum { Capacity = SensorTable::Capacity, MaxStages = 4 };
+
+    struct Stage
+    {
+        enum Kind { LowPass, OneEuro, Deadband };
+        Kind kind = LowPass;
+        // LowPass: seconds.
+        float timeConstant = 0.0f;
+        // OneEuro: cutoff of a sensor held still, in Hz, and how much it
+        // rises per radian per second of angular speed.
+        float minCutoff = 0.0f;
+        float beta = 0.0f;
+        // Deadband: radians.
+        float threshold = 0.0f;
+    };
+
+    // Parses a comma-separated chain such as "oneeuro:1.5:0.05,deadband:0.2":
+    //
+    //    lowpass:<time constant, ms>
+    //    oneeuro:<minimum cutoff, Hz>[:<beta>]
+    //    deadband:<threshold, degrees>
+    //
+    // An empty spec is an empty chain.
+    static bool parse(const QString &spec, QVector<Stage> *stages);
+
+    OrientationFilter();
+    OrientationFilter(const OrientationFilter &) = delete;
+    OrientationFilter &operator=(const OrientationFilter &) = delete;
+
+    // Must not be called once samples are being filtered. Stages beyond
+    // MaxStages are ignored.
+    void setStages(const QVector<Stage> &stages);
+    bool isEmpty() const { return m_stageCount == 0; }
+
+    // Filters the orientation of count samples in place, in order.
+    void update(SensorSample *samples, int count);
+
+private:
+    // A multiple of any vector width, and room for a whole packet.
+    enum { Lanes = SensorProtocol::MaxSamples + 1 };
+
+    struct Batch;
+
+    void step(SensorSample *samples, int lanes);
+    template<int Kind>
+    static void filterLanes(Batch *batch, const Stage &stage, int padded);
+
+    // Per stage and sensor filter state: the last output, and for OneEuro
+    // the smoothed angular speed.
+    struct State
+    {
+        alignas(64) float q0[Capacity];
+        alignas(64) float q1[Capacity];
+        alignas(64) float q2[Capacity];
+        alignas(64) float q3[Capacity];
+        alignas(64) float speed[Capacity];
+    };
+
+    Stage m_stages[MaxStages];
+    int m_stageCount;
+    State m_state[MaxStages];
+    qint64 m_lastTime[Capacity];
+    bool m_started[Capacity];
+    bool m_queued[Capacity];
+
+    // The lanes of the batch being updated.
+    struct Batch
+    {
+        alignas(64) float q0[Lanes];
+        alignas(64) float q1[Lanes];
+        alignas(64) float q2[Lanes];
+        alignas(64) float q3[Lanes];
+        alignas(64) float s0[Lanes];
+        alignas(64) float s1[Lanes];
+        alignas(64) float s2[Lanes];
+        alignas(64) float s3[Lanes];
+        alignas(64) float speed[Lanes];
+        alignas(64) float dt[Lanes];
+        alignas(64) float fresh[Lanes];
+        int sample[Lanes];
+    };
+    Batch m_batch;
+};
@@ -0,0 +1,390 @@
+#include "oscprotocol.h"
+#include "sensortable.h"
+
+#include <QtEndian>
+
+#include <cstring>
+
+
+namespace
+{
+    // Bundles within bundles deeper than this are rejected.
+    const int MaxBundleDepth = 8;
+    // OSC time tag meaning "immediately".
+    const quint64 Immediately = 1;
+    // Limits on address pattern parts; MaxPatternLength states and the
+    // final one fit a 64-bit mask.
+    const int MaxPatternLength = 63;
+    const int MaxWildcards = 16;
+
+    struct Output
+    {
+        SensorSample *samples;
+        int count;
+    };
+
+    // An address pattern part, compiled into the states of a nondeterministic
+    // automaton, one per character, that is run on all its states at once: a
+    // set of states is a bit mask. Matching is thus linear in the lengths of
+    // the pattern and the name, however many wildcards the pattern has, and
+    // allocates nothing. Parts longer than MaxPatternLength, or with more than
+    // MaxWildcards wildcards, are not matched at all.
+    struct Pattern
+    {
+        enum Kind : quint8 {
+            Literal,
+            Any,                // ?
+            Star,               // *
+            Class,              // [...], next: the state after it
+            BraceOpen,          // {, next: its }
+            AlternativeEnd      // , or } in braces, next: the state after the }
+        };
+
+        const char *text;
+        int length;
+        quint8 kind[MaxPatternLength];
+        quint8 next[MaxPatternLength];
+    };
+}
+
+
+// Reads the NUL-terminated, 4-byte padded OSC string at *p, advancing *p
+// past it.
+static bool
+readString(const char **p, const char *end, const char **string, int *length) {
+    const char *nul = static_cast<const char *>(memchr(*p, 0, end - *p));
+    if(!nul)
+        return false;
+    *string = *p;
+    *length = int(nul - *p);
+    *p += (*length + 4) & ~3;
+    return *p <= end;
+}
+
+
+static float
+readFloat(const char *p) {
+    const quint32 bits = qFromBigEndian<quint32>(p);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+
+static bool
+compile(const char *p, const char *pe, Pattern *pattern) {
+    const int length = int(pe - p);
+    if(length > MaxPatternLength)
+        return false;
+    pattern->text = p;
+    pattern->length = length;
+    int wildcards = 0;
+    for(int i = 0; i < length; ) {
+        switch(p[i]) {
+        case '?':
+            pattern->kind[i++] = Pattern::Any;
+            ++wildcards;
+            break;
+        case '*':
+            pattern->kind[i++] = Pattern::Star;
+            ++wildcards;
+            break;
+        case '[': {
+            const char *close = static_cast<const char *>(memchr(p + i + 1, ']', length - i - 1));
+            if(!close)
+                return false;
+            pattern->kind[i] = Pattern::Class;
+            pattern->next[i] = quint8(close - p + 1);
+            i = int(close - p + 1);
+            ++wildcards;
+            break;
+        }
+        case '{': {
+            const char *close = static_cast<const char *>(memchr(p + i + 1, '}', length - i - 1));
+            if(!close)
+                return false;
+            const int end = int(close - p);
+            pattern->kind[i] = Pattern::BraceOpen;
+            pattern->next[i] = quint8(end);
+            for(++i; i < end; ++i) {
+                pattern->kind[i] = p[i] == ',' ? Pattern::AlternativeEnd : Pattern::Literal;
+                pattern->next[i] = quint8(end + 1);
+            }
+            pattern->kind[end] = Pattern::AlternativeEnd;
+            pattern->next[end] = quint8(end + 1);
+            i = end + 1;
+            ++wildcards;
+            break;
+        }
+        default:
+            pattern->kind[i++] = Pattern::Literal;
+        }
+    }
+    return wildcards <= MaxWildcards;
+}
+
+
+// Adds the states reached from those in states without reading a
+// character. These moves only ever go forward, so one pass does.
+static quint64
+closure(const Pattern &pattern, quint64 states) {
+    for(int i = 0; i < pattern.length; ++i) {
+        if(!(states & (quint64(1) << i)))
+            continue;
+        switch(pattern.kind[i]) {
+        case Pattern::Star:
+            states |= quint64(1) << (i + 1);
+            break;
+        case Pattern::BraceOpen:
+            // The start of every alternative.
+            states |= quint64(1) << (i + 1);
+            for(int j = i + 1; j < pattern.next[i]; ++j) {
+                if(pattern.kind[j] == Pattern::AlternativeEnd)
+                    states |= quint64(1) << (j + 1);
+            }
+            break;
+        case Pattern::AlternativeEnd:
+            states |= quint64(1) << pattern.next[i];
+            break;
+        default:
+            break;
+        }
+    }
+    return states;
+}
+
+
+static bool
+inClass(const char *p, const char *pe, char c) {
+    const bool negated = p < pe && *p == '!';
+    if(negated)
+        ++p;
+    bool found = false;
+    while(p < pe) {
+        if(p + 2 < pe && p[1] == '-') {
+            found = found || (c >= p[0] && c <= p[2]);
+            p += 3;
+        } else {
+            found = found || c == *p;
+            ++p;
+        }
+    }
+    return found != negated;
+}
+
+
+// The states reached from those in states by reading c.
+static quint64
+advance(const Pattern &pattern, quint64 states, char c) {
+    quint64 result = 0;
+    for(int i = 0; i < pattern.length; ++i) {
+        if(!(states & (quint64(1) << i)))
+            continue;
+        switch(pattern.kind[i]) {
+        case Pattern::Literal:
+            if(pattern.text[i] == c)
+                result |= quint64(1) << (i + 1);
+            break;
+        case Pattern::Any:
+            result |= quint64(1) << (i + 1);
+            break;
+        case Pattern::Star:
+            result |= quint64(1) << i;
+            break;
+        case Pattern::Class:
+            if(inClass(pattern.text + i + 1, pattern.text + pattern.next[i] - 1, c))
+                result |= quint64(1) << pattern.next[i];
+            break;
+        default:
+            break;
+        }
+    }
+    return closure(pattern, result);
+}
+
+
+static bool
+accepts(const Pattern &pattern, quint64 states) {
+    return states & (quint64(1) << pattern.length);
+}
+
+
+static bool
+matches(const char *p, const char *pe, const char *name) {
+    Pattern pattern;
+    if(!compile(p, pe, &pattern))
+        return false;
+    quint64 states = closure(pattern, 1);
+    for(; *name && states; ++name)
+        states = advance(pattern, states, *name);
+    return accepts(pattern, states);
+}
+
+
+// Sets in ids the bits of the sensor IDs below SensorTable::Capacity whose
+// decimal names, without leading zeros, pattern matches: every name
+// starting with the digits read so far, of value prefix, that reached
+// states.
+static void
+matchIds(const Pattern &pattern, quint64 states, int prefix, quint64 *ids) {
+    for(int digit = prefix == 0 ? 1 : 0; digit <= 9; ++digit) {
+        const int id = prefix * 10 + digit;
+        if(id >= SensorTable::Capacity)
+            break;
+        const quint64 next = advance(pattern, states, char('0' + digit));
+        if(!next)
+            continue;
+        if(accepts(pattern, next))
+            ids[id / 64] |= quint64(1) << (id % 64);
+        matchIds(pattern, next, id, ids);
+    }
+}
+
+
+static bool
+hasWildcards(const char *p, const char *pe) {
+    for(; p < pe; ++p) {
+        if(*p == '?' || *p == '*' || *p == '[' || *p == '{')
+            return true;
+    }
+    return false;
+}
+
+
+static void
+appendSample(Output *output, const SensorSample &sample, int sensorId) {
+    if(output->count == SensorProtocol::MaxSamples)
+        return;
+    SensorSample &target = output->samples[output->count++];
+    target = sample;
+    target.sensorId = quint16(sensorId);
+}
+
+
+// Parses one message; messages to addresses outside /sensor/<id>/quat
+// are skipped.
+static bool
+parseMessage(const char *p, const char *end, quint64 timeTag, Output *output) {
+    const char *address;
+    const char *types;
+    int addressLength;
+    int typesLength;
+    if(!readString(&p, end, &address, &addressLength)
+            || !readString(&p, end, &types, &typesLength))
+        return false;
+
+    // Split the pattern into its three parts.
+    const char *addressEnd = address + addressLength;
+    const char *parts[4];
+    int partCount = 0;
+    for(const char *c = address; c < addressEnd; ++c) {
+        if(*c != '/')
+            continue;
+        if(partCount == 3)
+            return true;
+        parts[partCount++] = c + 1;
+    }
+    if(partCount != 3 || address[0] != '/')
+        return true;
+    parts[3] = addressEnd + 1;
+    if(!matches(parts[0], parts[1] - 1, "sensor") || !matches(parts[2], parts[3] - 1, "quat"))
+        return true;
+
+    const bool sequenced = typesLength == 6 && memcmp(types, ",ffffi", 6) == 0;
+    if(!sequenced && !(typesLength == 5 && memcmp(types, ",ffff", 5) == 0))
+        return false;
+    if(end - p < (sequenced ? 20 : 16))
+        return false;
+    SensorSample sample;
+    sample.w = readFloat(p);
+    sample.x = readFloat(p+4);
+    sample.y = readFloat(p+8);
+    sample.z = readFloat(p+12);
+    if(sequenced) {
+        sample.sequence = qFromBigEndian<quint32>(p+16);
+        sample.sequenced = true;
+    }
+    if(timeTag != Immediately) {
+        // NTP format: seconds, then fractions of a second in 32 bits.
+        sample.senderTime = qint64(timeTag >> 32) * 1000000000
+                          + qint64(((timeTag & 0xffffffff) * 1000000000) >> 32);
+        sample.senderTimed = true;
+    }
+
+    const char *id = parts[1];
+    const char *idEnd = parts[2] - 1;
+    if(!hasWildcards(id, idEnd)) {
+        int sensorId = 0;
+        if(id == idEnd || idEnd - id > 5)
+            return true;
+        for(const char *c = id; c < idEnd; ++c) {
+            if(*c < '0' || *c > '9')
+                return true;
+            sensorId = sensorId * 10 + (*c - '0');
+        }
+        if(sensorId <= 0xffff)
+            appendSample(output, sample, sensorId);
+        return true;
+    }
+    Pattern pattern;
+    if(!compile(id, idEnd, &pattern))
+        return true;
+    quint64 ids[SensorTable::Capacity / 64] = {};
+    const quint64 start = closure(pattern, 1);
+    // "0" is the only name starting with a zero.
+    if(accepts(pattern, advance(pattern, start, '0')))
+        ids[0] |= 1;
+    matchIds(pattern, start, 0, ids);
+    for(int sensorId = 0; sensorId < SensorTable::Capacity; ++sensorId) {
+        if(ids[sensorId / 64] & (quint64(1) << (sensorId % 64)))
+            appendSample(output, sample, sensorId);
+    }
+    return true;
+}
+
+
+static bool
+parseElement(const char *p, const char *end, quint64 timeTag, int depth, Output *output) {
+    if(end - p >= 8 && memcmp(p, "#bundle", 8) == 0) {
+        if(depth == MaxBundleDepth || end - p < 16)
+            return false;
+        timeTag = qFromBigEndian<quint64>(p+8);
+        for(p += 16; p < end; ) {
+            if(end - p < 4)
+                return false;
+            const qint32 size = qFromBigEndian<qint32>(p);
+            p += 4;
+            if(size <= 0 || size % 4 != 0 || size > end - p)
+                return false;
+            if(!parseElement(p, p + size, timeTag, depth + 1, output))
+                return false;
+            p += size;
+        }
+        return true;
+    }
+    if(p == end || *p != '/')
+        return false;
+    return parseMessage(p, end, timeTag, output);
+}
+
+
+bool
+OscProtocol::isOsc(const char *data, int size) {
+    // Unversioned native packets can start with anything, but no useful
+    // OSC datagram has their sizes.
+    if(size < 4 || size == SensorProtocol::LegacyPacketSize
+            || size == SensorProtocol::AddressedPacketSize)
+        return false;
+    return data[0] == '/' || (size >= 8 && memcmp(data, "#bundle", 8) == 0);
+}
+
+
+SensorProtocol::Status
+OscProtocol::parse(const char *data, int size, SensorSample *samples, int *count) {
+    Output output = { samples, 0 };
+    *count = 0;
+    if(size % 4 != 0 || !parseElement(data, data + size, Immediately, 0, &output))
+        return SensorProtocol::Malformed;
+    *count = output.count;
+    return SensorProtocol::Ok;
+}
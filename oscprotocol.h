@@ -0,0 +1,33 @@
+#pragma once
+
+#include "sensorprotocol.h"
+#include "sensorsample.h"
+
+
+// Open Sound Control input, for motion-capture tools that speak OSC 1.0
+// rather than the native protocol. The address space is
+//
+//    /sensor/<id>/quat  ffff   w, x, y, z
+//    /sensor/<id>/quat  ffffi  w, x, y, z, sequence number
+//
+// Incoming address patterns are matched against it with the OSC rules
+// (?, *, [a-z], [!...], {foo,bar}), so a pattern that matches several
+// sensor IDs sets all of them. Matching takes time linear in the length
+// of the pattern; pattern parts longer than 63 characters, or with more
+// than 16 wildcards, match nothing. Messages may come alone or in
+// bundles, nested or not; the time tag of a bundle, unless "immediately",
+// becomes the sender timestamp of its samples. Messages to other
+// addresses are ignored.
+//
+// OSC datagrams start with '/' or "#bundle" and are never the size of an
+// unversioned native packet, which tells them apart from native packets,
+// so any input accepts both.
+namespace OscProtocol
+{
+    bool isOsc(const char *data, int size);
+
+    // Parses in place, without copying or allocating, into samples, which
+    // must have room for SensorProtocol::MaxSamples; matches beyond that
+    // are dropped. On success count is the number of samples found.
+    SensorProtocol::Status parse(const char *data, int size, SensorSample *samples, int *count);
+}
@@ -0,0 +1,153 @@
+#include "packethandler.h"
+#include "hotlog.h"
+#include "oscprotocol.h"
+#include "sensorclock.h"
+
+
+//============================================================================//
+//                                PacketHandler                               //
+//============================================================================//
+
+PacketHandler::PacketHandler(SensorTable *table)
+    : m_table(table)
+    , m_writer(table->registerWriter())
+    , m_producer(table->bus().registerProducer())
+    , m_calibrator(table)
+{
+}
+
+
+int
+PacketHandler::handle(const char *data, int size, qint64 arrivalTime, char *reply) {
+    m_datagrams.add();
+    if (SensorProtocol::isTimeRequest(data, size))
+        return handleTimeRequest(data, size, arrivalTime, reply);
+    int count = 0;
+    const SensorProtocol::Status status = OscProtocol::isOsc(data, size)
+            ? OscProtocol::parse(data, size, m_samples, &count)
+            : SensorProtocol::parse(data, size, m_samples, m_readings, &count);
+    switch (status) {
+    case SensorProtocol::Ok:
+        break;
+    case SensorProtocol::Malformed:
+        m_malformed.add();
+        HotLog::log(HotLog::MalformedPacket, size);
+        return 0;
+    case SensorProtocol::UnsupportedVersion:
+        m_unsupportedVersion.add();
+        HotLog::log(HotLog::UnsupportedVersion, quint8(data[2]));
+        return 0;
+    }
+    // Samples sent together all arrived at the same time; spread them back
+    // in time by their sender timestamps, the newest one at arrival.
+    qint64 newest = 0;
+    for (int i = 0; i < count; ++i) {
+        if (m_samples[i].senderTimed && m_samples[i].senderTime > newest)
+            newest = m_samples[i].senderTime;
+    }
+    for (int i = 0; i < count; ++i) {
+        SensorSample &sample = m_samples[i];
+        sample.arrivalTime = arrivalTime;
+        sample.sampleTime = sample.senderTimed ? arrivalTime - (newest - sample.senderTime)
+                                               : arrivalTime;
+        qint64 captureTime;
+        if (sample.senderTimed
+                && m_clockSync.toLocal(sample.sensorId, sample.senderTime, &captureTime)) {
+            // Never after arrival, whatever the error of the mapping.
+            sample.sampleTime = qMin(captureTime, arrivalTime);
+            sample.synchronized = true;
+        }
+    }
+    // Only samples the table takes are fused, filtered and calibrated, so
+    // that stale samples and other threads' do not disturb the filters,
+    // and a tare is never taken from one. admit() does not look at the
+    // orientation fusion fills in.
+    int accepted = 0;
+    int claimed = 0;
+    for (int i = 0; i < count; ++i) {
+        const SensorSample &sample = m_samples[i];
+        switch (m_table->admit(sample, m_writer)) {
+        case SensorTable::Accepted:
+            if (sample.fused)
+                m_readings[accepted] = m_readings[i];
+            m_accepted[accepted++] = sample;
+            m_claimed[claimed++] = sample.sensorId;
+            break;
+        case SensorTable::Stale:
+            m_claimed[claimed++] = sample.sensorId;
+            break;
+        case SensorTable::UnknownSensor:
+            m_unknownSensor.add();
+            HotLog::log(HotLog::UnknownSensor, sample.sensorId);
+            break;
+        case SensorTable::Foreign:
+            m_foreign.add();
+            break;
+        }
+    }
+    m_fusion.update(m_accepted, m_readings, accepted);
+    m_filter.update(m_accepted, accepted);
+    m_calibrator.update(m_accepted, accepted);
+    for (int i = 0; i < accepted; ++i)
+        m_table->publish(&m_accepted[i]);
+    for (int i = 0; i < claimed; ++i)
+        m_table->release(m_claimed[i], m_writer);
+    m_table->bus().publish(m_producer, m_accepted, accepted);
+    return 0;
+}
+
+
+int
+PacketHandler::handleTimeRequest(const char *data, int size, qint64 arrivalTime, char *reply) {
+    char unused[SensorProtocol::TimeResponseSize];
+    SensorProtocol::ClockRequest request;
+    if (SensorProtocol::answerTimeRequest(data, size, arrivalTime, SensorClock::now(),
+                                          &request, reply ? reply : unused) != SensorProtocol::Ok) {
+        m_malformed.add();
+        HotLog::log(HotLog::MalformedTimeRequest, size);
+        return 0;
+    }
+    m_clockSync.update(request);
+    return reply ? int(SensorProtocol::TimeResponseSize) : 0;
+}
+
+
+void
+PacketHandler::setFilters(const QVector<OrientationFilter::Stage> &stages) {
+    m_filter.setStages(stages);
+}
+
+
+void
+PacketHandler::countTruncated() {
+    m_datagrams.add();
+    m_malformed.add();
+    HotLog::log(HotLog::TruncatedPacket);
+}
+
+
+void
+PacketHandler::countCorrupt() {
+    m_datagrams.add();
+    m_malformed.add();
+    HotLog::log(HotLog::CorruptFrame);
+}
+
+
+void
+PacketHandler::setKernelDrops(quint64 drops) {
+    m_kernelDrops.set(drops);
+}
+
+
+ReceiverStatistics
+PacketHandler::statistics() const {
+    ReceiverStatistics result;
+    result.datagrams = m_datagrams.value();
+    result.malformed = m_malformed.value();
+    result.unsupportedVersion = m_unsupportedVersion.value();
+    result.unknownSensor = m_unknownSensor.value();
+    result.kernelDrops = m_kernelDrops.value();
+    result.foreign = m_foreign.value();
+    return result;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "calibrator.h"
+#include "clocksync.h"
+#include "imufusion.h"
+#include "orientationfilter.h"
+#include "sensorprotocol.h"
+#include "sensorstatistics.h"
+#include "sensortable.h"
+
+
+// The part of ingest every input shares: parses a native or OSC packet in
+// place, dates the samples, publishes them to the SensorTable and its
+// SampleBus and keeps the counters. The samples the table accepts have
+// the orientation of raw IMU readings fused, go through an optional chain
+// of filters that smooths their orientations, then are calibrated just
+// before they are published. Time requests are answered and feed the mapping of
+// their sender's clock that dates its samples. Each input thread owns its
+// own PacketHandler, which publishes as one SensorTable writer and one
+// SampleBus producer.
+class PacketHandler
+{
+public:
+    explicit PacketHandler(SensorTable *table);
+    PacketHandler(const PacketHandler &) = delete;
+    PacketHandler &operator=(const PacketHandler &) = delete;
+
+    // A time request is answered into reply, if not null, which must have
+    // room for SensorProtocol::TimeResponseSize. Returns the size of the
+    // answer to send back, or 0 for none.
+    int handle(const char *data, int size, qint64 arrivalTime, char *reply = nullptr);
+    // Must be called before the first packet is handled.
+    void setFilters(const QVector<OrientationFilter::Stage> &stages);
+    void countTruncated();
+    void countCorrupt();
+    void setKernelDrops(quint64 drops);
+
+    // May be called from any thread.
+    ReceiverStatistics statistics() const;
+
+private:
+    int handleTimeRequest(const char *data, int size, qint64 arrivalTime, char *reply);
+
+    SensorTable *m_table;
+    int m_writer;
+    int m_producer;
+    SensorSample m_samples[SensorProtocol::MaxSamples];
+    SensorSample m_accepted[SensorProtocol::MaxSamples];
+    // Sensor IDs of the streams admit() claimed, until they are released.
+    int m_claimed[SensorProtocol::MaxSamples];
+    SensorProtocol::ImuReading m_readings[SensorProtocol::MaxSamples];
+    ImuFusion m_fusion;
+    ClockSync m_clockSync;
+    OrientationFilter m_filter;
+    Calibrator m_calibrator;
+    StatisticsCounter m_datagrams;
+    StatisticsCounter m_malformed;
+    StatisticsCounter m_unsupportedVersion;
+    StatisticsCounter m_unknownSensor;
+    StatisticsCounter m_kernelDrops;
+    StatisticsCounter m_foreign;
+};
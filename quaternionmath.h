@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cmath>
+
+
+// Minimal quaternion helpers for the ingest path, which works on plain
+// floats rather than QQuaternion so that it can later be batched.
+// Quaternions are (w, x, y, z) and rotation vectors are axis * angle in
+// radians.
+namespace QuaternionMath
+{
+    struct Quaternion
+    {
+        float w, x, y, z;
+    };
+
+    inline Quaternion multiply(const Quaternion &a, const Quaternion &b) {
+        return {
+            a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+            a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+            a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+            a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w
+        };
+    }
+
+    inline Quaternion conjugate(const Quaternion &q) {
+        return { q.w, -q.x, -q.y, -q.z };
+    }
+
+    inline float dot(const Quaternion &a, const Quaternion &b) {
+        return a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z;
+    }
+
+    inline Quaternion normalized(const Quaternion &q) {
+        const float length = std::sqrt(dot(q, q));
+        if (length <= 0.0f)
+            return { 1.0f, 0.0f, 0.0f, 0.0f };
+        return { q.w / length, q.x / length, q.y / length, q.z / length };
+    }
+
+    inline Quaternion fromRotationVector(float rx, float ry, float rz) {
+        const float angle = std::sqrt(rx * rx + ry * ry + rz * rz);
+        if (angle < 1.0e-6f)
+            return normalized({ 1.0f, 0.5f * rx, 0.5f * ry, 0.5f * rz });
+        const float s = std::sin(0.5f * angle) / angle;
+        return { std::cos(0.5f * angle), rx * s, ry * s, rz * s };
+    }
+
+    // Takes the short way round, so q and -q give the same vector.
+    inline void toRotationVector(const Quaternion &q, float *r) {
+        const float sign = q.w < 0.0f ? -1.0f : 1.0f;
+        const float sinHalf = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z);
+        const float angle = 2.0f * std::atan2(sinHalf, sign * q.w);
+        const float scale = sinHalf < 1.0e-6f ? 2.0f * sign : sign * angle / sinHalf;
+        r[0] = q.x * scale;
+        r[1] = q.y * scale;
+        r[2] = q.z * scale;
+    }
+
+    inline Quaternion slerp(const Quaternion &a, Quaternion b, float t) {
+        float cosine = dot(a, b);
+        if (cosine < 0.0f) {
+            b = { -b.w, -b.x, -b.y, -b.z };
+            cosine = -cosine;
+        }
+        float wa = 1.0f - t;
+        float wb = t;
+        if (cosine < 0.9995f) {
+            const float angle = std::acos(cosine);
+            const float s = 1.0f / std::sin(angle);
+            wa = std::sin((1.0f - t) * angle) * s;
+            wb = std::sin(t * angle) * s;
+        }
+        return normalized({ wa * a.w + wb * b.w, wa * a.x + wb * b.x,
+                            wa * a.y + wb * b.y, wa * a.z + wb * b.z });
+    }
+}
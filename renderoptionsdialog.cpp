@@ -136,6 +136,14 @@ RenderOptionsDialog::RenderOptionsDialog()
         }
     }
 
+    QPushButton *tareButton = new QPushButton(tr("Tare sensors"));
+    connect(tareButton, &QPushButton::clicked, this, &RenderOptionsDialog::tareRequested);
+    layout->addWidget(tareButton);
+    QPushButton *clearTareButton = new QPushButton(tr("Clear tare"));
+    connect(clearTareButton, &QPushButton::clicked, this, &RenderOptionsDialog::tareCleared);
+    layout->addWidget(clearTareButton);
+    ++row;
+
     layout->addWidget(new QLabel(tr("Texture:")));
     m_textureCombo = new QComboBox;
     connect(m_textureCombo, QOverload<int>::of(&QComboBox::currentIndexChanged),
@@ -82,6 +82,8 @@ signals:
     void floatParameterChanged(const QString &, float);
     void textureChanged(int);
     void shaderChanged(int);
+    void tareRequested();
+    void tareCleared();
     void doubleClicked();
 
 protected:
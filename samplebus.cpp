@@ -0,0 +1,188 @@
+#include "samplebus.h"
+#include "sensorclock.h"
+
+#include <QThread>
+
+#include <cstring>
+
+
+// Times a producer checks on a consumer before it starts giving up its
+// CPU, and looking at the clock, in between.
+static const int SpinsBeforeYield = 64;
+
+
+//============================================================================//
+//                                  SampleBus                                 //
+//============================================================================//
+
+SampleBus::SampleBus()
+    : m_producerCount(0)
+    , m_consumerCount(0)
+{
+    for (std::atomic<Ring *> &ring : m_rings)
+        ring.store(nullptr, std::memory_order_relaxed);
+}
+
+
+SampleBus::~SampleBus() {
+    for (std::atomic<Ring *> &ring : m_rings)
+        delete ring.load(std::memory_order_relaxed);
+    const int consumers = m_consumerCount.load(std::memory_order_relaxed);
+    for (int i = 0; i < consumers; ++i)
+        delete m_consumers[i];
+}
+
+
+int
+SampleBus::registerProducer() {
+    const int producer = m_producerCount.load(std::memory_order_relaxed);
+    if (producer == MaxProducers)
+        return -1;
+    m_producerCount.store(producer + 1, std::memory_order_release);
+    if (m_consumerCount.load(std::memory_order_relaxed) > 0)
+        allocateRings();
+    return producer;
+}
+
+
+SampleBus::Consumer *
+SampleBus::addConsumer(Policy policy) {
+    const int count = m_consumerCount.load(std::memory_order_relaxed);
+    if (count == MaxConsumers)
+        return nullptr;
+    allocateRings();
+    Consumer *consumer = new Consumer(this, policy);
+    // Start from what is being published now.
+    const int producers = m_producerCount.load(std::memory_order_relaxed);
+    for (int i = 0; i < producers; ++i) {
+        const quint64 cursor = m_rings[i].load(std::memory_order_relaxed)
+                               ->cursor.load(std::memory_order_acquire);
+        consumer->m_cursors[i].next.store(cursor, std::memory_order_relaxed);
+    }
+    m_consumers[count] = consumer;
+    m_consumerCount.store(count + 1, std::memory_order_release);
+    return consumer;
+}
+
+
+void
+SampleBus::allocateRings() {
+    const int producers = m_producerCount.load(std::memory_order_relaxed);
+    for (int i = 0; i < producers; ++i) {
+        if (!m_rings[i].load(std::memory_order_relaxed))
+            m_rings[i].store(new Ring, std::memory_order_release);
+    }
+}
+
+
+void
+SampleBus::publish(int producer, const SensorSample *samples, int count) {
+    if (producer < 0 || count == 0)
+        return;
+    Ring *ring = m_rings[producer].load(std::memory_order_acquire);
+    if (!ring)
+        return;
+    const quint64 first = ring->cursor.load(std::memory_order_relaxed);
+    const quint64 end = first + quint64(count);
+    if (end > Capacity)
+        waitForConsumers(producer, end - Capacity);
+    for (quint64 sequence = first; sequence < end; ++sequence) {
+        quint64 words[WordCount] = {};
+        memcpy(words, &samples[sequence - first], sizeof(SensorSample));
+        Slot &slot = ring->entries[sequence % Capacity];
+        slot.stamp.store(2 * sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (int i = 0; i < WordCount; ++i)
+            slot.words[i].store(words[i], std::memory_order_relaxed);
+        slot.stamp.store(2 * sequence + 2, std::memory_order_release);
+    }
+    ring->cursor.store(end, std::memory_order_release);
+}
+
+
+// Waits until every lossless consumer that is keeping up has read the
+// samples of producer before sequence number needed.
+void
+SampleBus::waitForConsumers(int producer, quint64 needed) {
+    const int consumers = m_consumerCount.load(std::memory_order_acquire);
+    qint64 deadline = 0;
+    for (int i = 0; i < consumers; ++i) {
+        Consumer *consumer = m_consumers[i];
+        if (consumer->m_policy != Lossless)
+            continue;
+        Consumer::Cursor &cursor = consumer->m_cursors[producer];
+        if (cursor.lagging.load(std::memory_order_relaxed))
+            continue;
+        for (int spins = 0; cursor.next.load(std::memory_order_acquire) < needed; ++spins) {
+            if (spins < SpinsBeforeYield)
+                continue;
+            const qint64 now = SensorClock::now();
+            if (deadline == 0) {
+                deadline = now + MaxProducerWait;
+            } else if (now > deadline) {
+                cursor.lagging.store(true, std::memory_order_relaxed);
+                break;
+            }
+            QThread::yieldCurrentThread();
+        }
+    }
+}
+
+
+//============================================================================//
+//                             SampleBus::Consumer                            //
+//============================================================================//
+
+SampleBus::Consumer::Consumer(SampleBus *bus, Policy policy)
+    : m_bus(bus)
+    , m_policy(policy)
+    , m_firstRing(0)
+{
+}
+
+
+int
+SampleBus::Consumer::poll(SensorSample *samples, int max) {
+    const int producers = m_bus->m_producerCount.load(std::memory_order_acquire);
+    if (producers == 0)
+        return 0;
+    int n = 0;
+    // Start from another ring every time, so that a busy one does not
+    // starve the others when max is small.
+    m_firstRing = (m_firstRing + 1) % producers;
+    for (int k = 0; k < producers && n < max; ++k) {
+        const int r = (m_firstRing + k) % producers;
+        const Ring *ring = m_bus->m_rings[r].load(std::memory_order_acquire);
+        if (!ring)
+            continue;
+        Cursor &cursor = m_cursors[r];
+        quint64 next = cursor.next.load(std::memory_order_relaxed);
+        quint64 published = ring->cursor.load(std::memory_order_acquire);
+        while (next < published && n < max) {
+            if (published - next > Capacity) {
+                // Overrun: what is left of the missed samples is gone.
+                m_lost.add(published - Capacity - next);
+                next = published - Capacity;
+            }
+            const Slot &slot = ring->entries[next % Capacity];
+            const quint64 stamp = slot.stamp.load(std::memory_order_acquire);
+            quint64 words[WordCount];
+            for (int i = 0; i < WordCount; ++i)
+                words[i] = slot.words[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (stamp != 2 * next + 2 || slot.stamp.load(std::memory_order_relaxed) != stamp) {
+                // The producer is rewriting this slot already.
+                m_lost.add();
+                ++next;
+                published = ring->cursor.load(std::memory_order_acquire);
+                continue;
+            }
+            memcpy(&samples[n++], words, sizeof(SensorSample));
+            ++next;
+        }
+        cursor.next.store(next, std::memory_order_release);
+        if (cursor.lagging.load(std::memory_order_relaxed) && published - next < Capacity / 2)
+            cursor.lagging.store(false, std::memory_order_relaxed);
+    }
+    return n;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "sensorsample.h"
+#include "sensorstatistics.h"
+
+#include <atomic>
+
+
+// Every sample accepted on ingest, for consumers that need all of them,
+// such as a recorder, rather than the latest orientation of each stream
+// the SensorTable keeps.
+//
+// Each ingest thread is the single producer of its own ring, in the manner
+// of a disruptor: publish() writes the samples into the ring's entries and
+// then advances the ring's cursor, without a lock. Each Consumer keeps its
+// own read cursor per ring and copies samples out with poll(), also
+// without a lock, so consumers never wait for each other.
+//
+// What happens when a consumer falls a whole ring behind is its policy:
+//  - Lossy consumers are overrun; they skip to the oldest sample still in
+//    the ring and count the ones they missed.
+//  - Lossless consumers hold the producer back until they have read the
+//    slots it is about to reuse. The producer spins for them for at most
+//    MaxProducerWait, though; a consumer that still has not caught up is
+//    then treated as lossy until it is back within half a ring, so a
+//    stalled disk costs ingest one wait, not one per packet.
+// The render thread reads the SensorTable, not the bus, and never waits
+// for any of this.
+//
+// Producers and consumers are registered from one thread, usually before
+// ingest starts; consumers must outlive the producers. Rings are only
+// allocated once there is a consumer.
+class SampleBus
+{
+public:
+    enum {
+        Capacity = 16384,
+        MaxProducers = 128,
+        MaxConsumers = 8
+    };
+    // Longest time a producer waits for a lossless consumer, in
+    // nanoseconds.
+    static const qint64 MaxProducerWait = 1000000;
+
+    enum Policy {
+        Lossy,
+        Lossless
+    };
+
+    class Consumer
+    {
+    public:
+        // Copies up to max of the samples published since the last call
+        // into samples, oldest first for each producer, and returns how
+        // many. Only one thread may poll a given consumer.
+        int poll(SensorSample *samples, int max);
+        // Samples overrun before they could be read.
+        quint64 lost() const { return m_lost.value(); }
+
+    private:
+        friend class SampleBus;
+
+        Consumer(SampleBus *bus, Policy policy);
+
+        struct Cursor
+        {
+            alignas(64) std::atomic<quint64> next{0};
+            // Set by the producer once it has given up waiting.
+            std::atomic<bool> lagging{false};
+        };
+
+        SampleBus *m_bus;
+        Policy m_policy;
+        Cursor m_cursors[MaxProducers];
+        StatisticsCounter m_lost;
+        int m_firstRing;
+    };
+
+    SampleBus();
+    ~SampleBus();
+    SampleBus(const SampleBus &) = delete;
+    SampleBus &operator=(const SampleBus &) = delete;
+
+    // A new producer ID for an ingest thread, or -1 if there are too many.
+    int registerProducer();
+    // The bus owns the consumer.
+    Consumer *addConsumer(Policy policy);
+
+    void publish(int producer, const SensorSample *samples, int count);
+
+private:
+    enum { WordCount = (sizeof(SensorSample) + sizeof(quint64) - 1) / sizeof(quint64) };
+
+    // Stamped 2 * (sequence + 1) once the sample of that sequence number
+    // is complete, and odd while it is being written.
+    struct Slot
+    {
+        std::atomic<quint64> stamp{0};
+        std::atomic<quint64> words[WordCount];
+    };
+
+    struct Ring
+    {
+        // Sequence number of the next sample to publish.
+        alignas(64) std::atomic<quint64> cursor{0};
+        alignas(64) Slot entries[Capacity];
+    };
+
+    void allocateRings();
+    void waitForConsumers(int producer, quint64 needed);
+
+    std::atomic<Ring *> m_rings[MaxProducers];
+    std::atomic<int> m_producerCount;
+    Consumer *m_consumers[MaxConsumers];
+    std::atomic<int> m_consumerCount;
+};
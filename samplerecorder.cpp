@@ -0,0 +1,139 @@
+#include "samplerecorder.h"
+
+#include <QDebug>
+#include <QtEndian>
+
+#include <cstring>
+
+
+// Time to sleep when there is nothing to write, in milliseconds.
+static const int IdleInterval = 5;
+static const qint64 HeaderSize = 8;
+
+
+static void
+writeFloat(float value, char *data) {
+    quint32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    qToLittleEndian<quint32>(bits, data);
+}
+
+
+//============================================================================//
+//                               SampleRecorder                               //
+//============================================================================//
+
+SampleRecorder::SampleRecorder(SampleBus *bus, QObject *parent)
+    : QThread(parent)
+    , m_bus(bus)
+    , m_consumer(nullptr)
+{
+    setObjectName(QStringLiteral("Sample recorder"));
+}
+
+
+SampleRecorder::~SampleRecorder() {
+    stop();
+    wait();
+}
+
+
+// Only joins the bus once the file is ready, so that a recorder that
+// failed to open never holds ingest back.
+bool
+SampleRecorder::open(const QString &path) {
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Unable to open" << path << ":" << m_file.errorString();
+        return false;
+    }
+    if (m_file.write("BXSAMP01", HeaderSize) != HeaderSize) {
+        qWarning() << "Unable to write to" << path << ":" << m_file.errorString();
+        m_file.close();
+        return false;
+    }
+    m_consumer = m_bus->addConsumer(SampleBus::Lossless);
+    if (!m_consumer) {
+        qWarning() << "Too many sample bus consumers to record";
+        m_file.remove();
+        return false;
+    }
+    return true;
+}
+
+
+void
+SampleRecorder::stop() {
+    requestInterruption();
+}
+
+
+RecorderStatistics
+SampleRecorder::statistics() const {
+    RecorderStatistics statistics;
+    statistics.recorded = m_recorded.value();
+    statistics.lost = m_consumer ? m_consumer->lost() : 0;
+    statistics.writeErrors = m_writeErrors.value();
+    return statistics;
+}
+
+
+void
+SampleRecorder::run() {
+    if (!m_file.isOpen())
+        return;
+    for (;;) {
+        // Whatever was published before the interruption is still written.
+        const bool stopping = isInterruptionRequested();
+        const int count = m_consumer->poll(m_samples, BatchSize);
+        if (count > 0)
+            write(count);
+        else if (stopping)
+            break;
+        else
+            msleep(IdleInterval);
+    }
+    if (m_file.isOpen() && !m_file.flush()) {
+        m_writeErrors.add();
+        qWarning() << "Unable to write to" << m_file.fileName() << ":" << m_file.errorString();
+    }
+}
+
+
+// A record only partly written would put every later one out of step, so
+// the first write that fails ends the recording, cut back to the last
+// whole record. The bus is still drained after that, so that ingest is not
+// held back.
+void
+SampleRecorder::write(int count) {
+    if (!m_file.isOpen())
+        return;
+    char *record = m_buffer;
+    for (int i = 0; i < count; ++i, record += RecordSize) {
+        const SensorSample &sample = m_samples[i];
+        const quint16 flags = (sample.sequenced ? Sequenced : 0)
+                              | (sample.senderTimed ? SenderTimed : 0)
+                              | (sample.fused ? Fused : 0)
+                              | (sample.synchronized ? Synchronized : 0);
+        qToLittleEndian<quint16>(sample.sensorId, record);
+        qToLittleEndian<quint16>(flags, record + 2);
+        qToLittleEndian<quint32>(sample.sequence, record + 4);
+        qToLittleEndian<qint64>(sample.arrivalTime, record + 8);
+        qToLittleEndian<qint64>(sample.sampleTime, record + 16);
+        qToLittleEndian<qint64>(sample.senderTime, record + 24);
+        writeFloat(sample.w, record + 32);
+        writeFloat(sample.x, record + 36);
+        writeFloat(sample.y, record + 40);
+        writeFloat(sample.z, record + 44);
+    }
+    const qint64 size = qint64(count) * RecordSize;
+    if (m_file.write(m_buffer, size) != size) {
+        m_writeErrors.add();
+        qWarning() << "Unable to write to" << m_file.fileName() << ":" << m_file.errorString()
+                   << "; recording stopped";
+        m_file.resize(HeaderSize + qint64(m_recorded.value()) * RecordSize);
+        m_file.close();
+        return;
+    }
+    m_recorded.add(quint64(count));
+}
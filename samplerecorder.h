@@ -0,0 +1,61 @@
+#pragma once
+
+#include "samplebus.h"
+#include "sensorstatistics.h"
+
+#include <QFile>
+#include <QThread>
+
+
+// Writes every sample accepted on ingest to a file, for replay and offline
+// analysis, as a lossless SampleBus consumer.
+//
+// The file starts with the 8 bytes "BXSAMP01" and is followed by one
+// RecordSize-byte record per sample, all little-endian: sensor ID
+// (quint16), flags (quint16, see Flags), sequence number (quint32),
+// arrival, sample and sender times (qint64 each) and w, x, y, z (float
+// each). Samples of one stream are in the order they were accepted; the
+// streams of different ingest threads are interleaved.
+//
+// Runs on its own thread at low priority. A disk that stalls holds ingest
+// back once for at most SampleBus::MaxProducerWait, after which samples
+// are dropped and counted until the recorder catches up. A write that
+// fails, to a full disk say, ends the recording at the last whole record.
+class SampleRecorder : public QThread
+{
+    Q_OBJECT
+public:
+    enum {
+        RecordSize = 48,
+        BatchSize = 1024
+    };
+    enum Flags {
+        Sequenced = 0x01,
+        SenderTimed = 0x02,
+        Fused = 0x04,
+        Synchronized = 0x08
+    };
+
+    SampleRecorder(SampleBus *bus, QObject *parent = nullptr);
+    ~SampleRecorder();
+
+    // Must be called before the ingest threads start.
+    bool open(const QString &path);
+    void stop();
+    // May be called from any thread.
+    RecorderStatistics statistics() const;
+
+protected:
+    void run() override;
+
+private:
+    void write(int count);
+
+    SampleBus *m_bus;
+    SampleBus::Consumer *m_consumer;
+    QFile m_file;
+    SensorSample m_samples[BatchSize];
+    char m_buffer[BatchSize * RecordSize];
+    StatisticsCounter m_recorded;
+    StatisticsCounter m_writeErrors;
+};
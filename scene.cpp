@@ -49,13 +49,15 @@
 ****************************************************************************/
 
 #include "scene.h"
+#include "calibrator.h"
 #include "twosidedgraphicswidget.h"
+#include "sensorclock.h"
+#include "velocityestimator.h"
 
 #include <QMatrix4x4>
 #include <QRandomGenerator>
 #include <QVector3D>
 #include <qmath.h>
-#include <QNetworkDatagram>
 
 #include "3rdparty/fbm.h"
 
@@ -71,7 +73,7 @@ environmentShaderText[] =
         "gl_FragColor = textureCube(env, gl_TexCoord[1].xyz);"
     "}";
 
-Scene::Scene(int width, int height, int maxTextureSize)
+Scene::Scene(int width, int height, int maxTextureSize, const SensorOptions &options)
     : m_distExp(600)
     , m_frame(0)
     , m_maxTextureSize(maxTextureSize)
@@ -83,7 +85,17 @@ Scene::Scene(int width, int height, int maxTextureSize)
     , m_vertexShader(nullptr)
     , m_environmentShader(nullptr)
     , m_environmentProgram(nullptr)
-    , udpPort(3333)
+    , m_sharedMemory(nullptr)
+    , m_serial(nullptr)
+    , m_relay(nullptr)
+    , m_recorder(nullptr)
+    , m_aligner(nullptr)
+    , m_savedReferences(0)
+    , m_playoutDelay(qint64(options.playoutDelay) * 1000000)
+    , m_maxPrediction(qint64(options.maxPrediction) * 1000000)
+    , m_lastFrameTime(0)
+    , m_frameInterval(20000000)
+    , udpPort(options.udpPort)
 
 {
     setSceneRect(0, 0, width, height);
@@ -107,6 +119,10 @@ Scene::Scene(int width, int height, int maxTextureSize)
             this, &Scene::setTexture);
     connect(m_renderOptions, &RenderOptionsDialog::shaderChanged,
             this, &Scene::setShader);
+    connect(m_renderOptions, &RenderOptionsDialog::tareRequested,
+            this, &Scene::tareSensors);
+    connect(m_renderOptions, &RenderOptionsDialog::tareCleared,
+            this, &Scene::clearTare);
 
     m_itemDialog = new ItemDialog;
     connect(m_itemDialog, &ItemDialog::newItemTriggered, this, &Scene::newItem);
@@ -125,17 +141,119 @@ Scene::Scene(int width, int height, int maxTextureSize)
     m_timer = new QTimer(this);
     m_timer->setInterval(20);
     connect(m_timer, &QTimer::timeout,
-            this, [this](){ update(); });
+            this, [this]() {
+        // Tares are taken on ingest, whenever their sensors next send.
+        if (m_sensors.referenceCount() != m_savedReferences)
+            saveCalibration();
+        update();
+    });
     m_timer->start();
 
-    // Network UDP event listener
-    pUdpSocket = new QUdpSocket(this);
-    if(!pUdpSocket->bind(QHostAddress::Any, udpPort)) {
-        qDebug() << QString("Unable to bind... EXITING");
-        exit(-1);
+    // Calibrations from previous sessions, applied before any sample
+    // comes in
+    m_calibrationFile = options.calibrationFile;
+    if(!m_calibrationFile.isEmpty() && QFile::exists(m_calibrationFile)
+            && !Calibrator::load(m_calibrationFile, &m_sensors))
+        qWarning() << "Some sensor calibrations in" << m_calibrationFile << "are invalid";
+
+    // Every sample to disk, its consumer registered before any input
+    // starts publishing
+    if(!options.recordFile.isEmpty()) {
+        m_recorder = new SampleRecorder(&m_sensors.bus());
+        if(m_recorder->open(options.recordFile)) {
+            m_recorder->start(QThread::LowPriority);
+        } else {
+            qWarning() << "Sample recording disabled";
+            delete m_recorder;
+            m_recorder = nullptr;
+        }
+    }
+
+    // Streams resampled together, so that they are drawn from one instant
+    if(options.alignRate > 0) {
+        m_aligner = new StreamAligner(&m_sensors);
+        m_aligner->setRate(options.alignRate);
+        m_aligner->setDelay(options.alignDelay);
+        m_aligner->start(QThread::HighPriority);
+    }
+
+    // Network UDP listeners, each running on its own thread
+    const int ingestThreads = qMax(1, options.ingestThreads);
+    for(int i = 0; i < ingestThreads; ++i) {
+        SensorReceiver *receiver = new SensorReceiver(&m_sensors);
+        receiver->setBusyPoll(options.busyPoll);
+        receiver->setFilters(options.filters);
+        receiver->setAdmission(options.allowedSources, options.sourceRate);
+        receiver->setThreadOptions(options.ingestCpu < 0 ? -1 : options.ingestCpu + i,
+                                   options.realtimePriority);
+        if(!receiver->bind(udpPort, ingestThreads > 1)) {
+            qDebug() << QString("Unable to bind... EXITING");
+            exit(-1);
+        }
+        // Multicast is delivered to every socket that joins, so only the
+        // first receiver does.
+        if(i == 0 && !options.multicastGroup.isEmpty()
+                && !receiver->joinMulticast(options.multicastGroup, options.multicastInterface))
+            qWarning() << "Multicast reception disabled";
+        if(i == 0 && !options.localSocket.isEmpty() && !receiver->listenLocal(options.localSocket))
+            qWarning() << "Local sensor socket disabled";
+        if(i == 0 && !options.subscribeHost.isEmpty()
+                && !receiver->subscribe(options.subscribeHost, options.subscribePort))
+            qWarning() << "Relay subscription disabled";
+        startReceiver(receiver);
+    }
+
+    // OSC is understood on any input; some tools insist on their own port
+    if(options.oscPort) {
+        SensorReceiver *receiver = new SensorReceiver(&m_sensors);
+        receiver->setFilters(options.filters);
+        receiver->setAdmission(options.allowedSources, options.sourceRate);
+        if(receiver->bind(options.oscPort)) {
+            startReceiver(receiver);
+        } else {
+            qWarning() << "OSC port disabled";
+            delete receiver;
+        }
+    }
+
+    // Same-host bridges can hand packets over through shared memory
+    if(!options.sharedMemory.isEmpty()) {
+        m_sharedMemory = new SharedMemorySource(&m_sensors);
+        if(m_sharedMemory->open(options.sharedMemory)) {
+            m_sharedMemory->setFilters(options.filters);
+            m_sharedMemory->start(QThread::HighPriority);
+        } else {
+            delete m_sharedMemory;
+            m_sharedMemory = nullptr;
+        }
+    }
+
+    // Wired sensors, without a bridge in between
+    if(!options.serialDevice.isEmpty()) {
+        m_serial = new SerialSource(&m_sensors);
+        if(m_serial->open(options.serialDevice, options.serialBaudRate)) {
+            m_serial->setFilters(options.filters);
+            m_serial->start(QThread::HighPriority);
+        } else {
+            qWarning() << "Serial input disabled";
+            delete m_serial;
+            m_serial = nullptr;
+        }
+    }
+
+    // Viewers elsewhere can watch the same session through us
+    if(options.relayPort) {
+        m_relay = new SensorRelay(&m_sensors);
+        if(m_relay->bind(options.relayPort)) {
+            m_relay->setRate(options.relayRate);
+            m_relay->setAdmission(options.allowedSources, options.sourceRate);
+            m_relay->start();
+        } else {
+            qWarning() << "Sensor relay disabled";
+            delete m_relay;
+            m_relay = nullptr;
+        }
     }
-    connect(pUdpSocket, SIGNAL(readyRead()),
-            this, SLOT(onReadPendingDatagrams()));
 
     // Timer to Change Texture
     connect(&timerTexture, SIGNAL(timeout()),
@@ -145,6 +263,102 @@ Scene::Scene(int width, int height, int maxTextureSize)
 
 
 Scene::~Scene() {
+    if (m_relay) {
+        m_relay->stop();
+        m_relay->wait();
+        const RelayStatistics relayed = m_relay->statistics();
+        qInfo("Sensor relay: %llu ticks, %llu samples, %llu datagrams, %llu dropped, "
+              "%llu subscribers left, %llu requests challenged, %llu refused",
+              relayed.ticks, relayed.samples, relayed.datagrams, relayed.dropped,
+              relayed.subscribers, relayed.challenges, relayed.refused);
+        delete m_relay;
+    }
+    for (QThread *thread : qAsConst(m_ingestThreads)) {
+        thread->requestInterruption();
+        thread->quit();
+    }
+    for (QThread *thread : qAsConst(m_ingestThreads))
+        thread->wait();
+    if (m_sharedMemory) {
+        m_sharedMemory->stop();
+        m_sharedMemory->wait();
+    }
+    if (m_serial) {
+        m_serial->stop();
+        m_serial->wait();
+    }
+    // Only once the inputs have stopped publishing, so that the recorder
+    // writes everything they accepted
+    if (m_recorder) {
+        m_recorder->stop();
+        m_recorder->wait();
+        const RecorderStatistics recorded = m_recorder->statistics();
+        qInfo("Sample recorder: %llu samples, %llu lost, %llu write errors",
+              recorded.recorded, recorded.lost, recorded.writeErrors);
+        delete m_recorder;
+    }
+    if (m_aligner) {
+        m_aligner->stop();
+        m_aligner->wait();
+        const AlignerStatistics aligned = m_aligner->statistics();
+        qInfo("Sensor alignment: %llu frames, %llu skipped, %llu late samples, %llu lost, "
+              "%llu streams held for a short history",
+              aligned.frames, aligned.skipped, aligned.late, aligned.lost, aligned.truncated);
+        delete m_aligner;
+    }
+    const ReceiverStatistics received = receiverStatistics();
+    qInfo("Sensor datagrams: %llu received, %llu malformed, %llu unsupported version, "
+          "%llu unknown sensor, %llu dropped by the kernel, %llu from another thread's stream, "
+          "%llu from sources not allowed, %llu over their source's rate",
+          received.datagrams, received.malformed, received.unsupportedVersion,
+          received.unknownSensor, received.kernelDrops, received.foreign,
+          received.refused, received.rateLimited);
+    if (m_sharedMemory) {
+        const ReceiverStatistics shared = m_sharedMemory->statistics();
+        qInfo("Sensor shared memory: %llu packets, %llu malformed, %llu unsupported version, "
+              "%llu unknown sensor",
+              shared.datagrams, shared.malformed, shared.unsupportedVersion, shared.unknownSensor);
+        delete m_sharedMemory;
+    }
+    if (m_serial) {
+        const ReceiverStatistics serial = m_serial->statistics();
+        qInfo("Sensor serial port: %llu frames, %llu corrupt or malformed, "
+              "%llu unsupported version, %llu unknown sensor",
+              serial.datagrams, serial.malformed, serial.unsupportedVersion, serial.unknownSensor);
+        delete m_serial;
+    }
+    for (int id = 0; id < m_sensors.streamCount(); ++id) {
+        const StreamStatistics stream = m_sensors.statistics(id);
+        if (stream.received)
+            qInfo("Sensor %d: %llu received, %llu lost, %llu stale, %llu restarts",
+                  id, stream.received, stream.lost, stream.stale, stream.restarts);
+    }
+    for (int i = 0; i < m_receivers.size(); ++i) {
+        const LatencyHistogram &ingest = m_receivers[i]->ingestLatency();
+        if (ingest.count()) {
+            qInfo("Sensor ingest %d: %llu datagrams, p50 %.1f us, p99 %.1f us, max %.1f us",
+                  i, ingest.count(),
+                  ingest.percentile(0.50) / 1.0e3,
+                  ingest.percentile(0.99) / 1.0e3,
+                  ingest.maximum() / 1.0e3);
+        }
+    }
+    qDeleteAll(m_receivers);
+    qDeleteAll(m_ingestThreads);
+    if (m_arrivalToDraw.count()) {
+        qInfo("Sensor arrival to draw: %llu samples, p50 %.2f ms, p99 %.2f ms, max %.2f ms",
+              m_arrivalToDraw.count(),
+              m_arrivalToDraw.percentile(0.50) / 1.0e6,
+              m_arrivalToDraw.percentile(0.99) / 1.0e6,
+              m_arrivalToDraw.maximum() / 1.0e6);
+    }
+    if (m_captureToDraw.count()) {
+        qInfo("Sensor capture to draw: %llu samples, p50 %.2f ms, p99 %.2f ms, max %.2f ms",
+              m_captureToDraw.count(),
+              m_captureToDraw.percentile(0.50) / 1.0e6,
+              m_captureToDraw.percentile(0.99) / 1.0e6,
+              m_captureToDraw.maximum() / 1.0e6);
+    }
     delete m_box;
     qDeleteAll(m_textures);
     delete m_mainCubemap;
@@ -157,6 +371,29 @@ Scene::~Scene() {
 }
 
 
+// Moves a bound receiver to an ingest thread of its own and starts it.
+void
+Scene::startReceiver(SensorReceiver *receiver) {
+    QThread *thread = new QThread;
+    receiver->moveToThread(thread);
+    connect(thread, &QThread::started,
+            receiver, &SensorReceiver::run);
+    thread->setObjectName(QStringLiteral("Sensor ingest %1").arg(m_receivers.size()));
+    thread->start(QThread::HighPriority);
+    m_receivers.append(receiver);
+    m_ingestThreads.append(thread);
+}
+
+
+ReceiverStatistics
+Scene::receiverStatistics() const {
+    ReceiverStatistics result;
+    for (const SensorReceiver *receiver : m_receivers)
+        result += receiver->statistics();
+    return result;
+}
+
+
 void
 Scene::initGL() {
     m_box = new GLRoundedBox(0.25f, 1.0f, 10);
@@ -305,6 +542,12 @@ Scene::renderBoxes(const QMatrix4x4 &view, int excludeBox) {
         glMultMatrixf(m.constData());
         glRotatef(360.0f * i / m_programs.size(), 0.0f, 0.0f, 1.0f);
         glTranslatef(2.0f, 0.0f, 0.0f);
+        // Satellite i shows sensor stream i + 1, when there is one.
+        if (i + 1 < m_streamLive.size() && m_streamLive[i + 1]) {
+            QMatrix4x4 sensor;
+            sensor.rotate(m_streamRotations[i + 1]);
+            glMultMatrixf(sensor.constData());
+        }
         glScalef(0.3f, 0.6f, 0.6f);
 
         if (glActiveTexture) {
@@ -329,9 +572,11 @@ Scene::renderBoxes(const QMatrix4x4 &view, int excludeBox) {
         }
         glPopMatrix();
     }
+    renderSensorBoxes(view, invView);
     if (-1 != excludeBox) {
         QMatrix4x4 m;
-        m.rotate(QQuaternion(q0, q1, q2, q3));
+        if (!m_streamRotations.isEmpty())
+            m.rotate(m_streamRotations[0]);
         glMultMatrixf(m.constData());
         if (glActiveTexture) {
             if (m_dynamicCubemap)
@@ -461,11 +706,181 @@ Scene::renderCubemaps() {
 }
 
 
+// Sensor streams beyond the ones shown by the main box and the satellites
+// get smaller boxes of their own, on a ring outside the satellites. They
+// use the current shader and the static environment map.
+void
+Scene::renderSensorBoxes(const QMatrix4x4 &view, const QMatrix4x4 &invView) {
+    const int firstStream = m_programs.size() + 1;
+    const int count = m_streamLive.size() - firstStream;
+    if (count <= 0)
+        return;
+    QGLShaderProgram *program = m_programs[m_currentShader];
+    if (glActiveTexture)
+        m_environment->bind();
+    program->bind();
+    program->setUniformValue("tex", GLint(0));
+    program->setUniformValue("env", GLint(1));
+    program->setUniformValue("noise", GLint(2));
+    program->setUniformValue("view", view);
+    program->setUniformValue("invView", invView);
+    for (int k = 0; k < count; ++k) {
+        const int stream = firstStream + k;
+        if (!m_streamLive[stream])
+            continue;
+        QMatrix4x4 m;
+        m.rotate(m_trackBalls[1].rotation());
+        m.rotate(360.0f * k / count, 0.0f, 0.0f, 1.0f);
+        m.translate(3.0f, 0.0f, 0.0f);
+        m.rotate(m_streamRotations[stream]);
+        m.scale(0.2f, 0.4f, 0.4f);
+        glPushMatrix();
+        glMultMatrixf(m.constData());
+        m_box->draw();
+        glPopMatrix();
+    }
+    program->release();
+    if (glActiveTexture)
+        m_environment->unbind();
+}
+
+
+// Fetch the orientation of every sensor stream once per frame, so that the
+// boxes and their reflections in the cubemaps all agree. With a
+// StreamAligner they all come from its newest frame, taken at one instant.
+void
+Scene::updateSensorRotations() {
+    const qint64 now = SensorClock::now();
+    if (m_lastFrameTime != 0) {
+        const qint64 interval = qMin(now - m_lastFrameTime, qint64(100000000));
+        m_frameInterval += (interval - m_frameInterval) / 8;
+    }
+    m_lastFrameTime = now;
+
+    const int count = m_sensors.streamCount();
+    if (m_streamRotations.size() < count) {
+        m_streamRotations.resize(count);
+        m_streamLive.resize(count);
+        m_lastDrawnArrival.resize(count);
+    }
+    if (m_aligner) {
+        if (!m_aligner->latest(&m_alignedFrame))
+            return;
+        const int aligned = qMin(count, m_alignedFrame.streamCount);
+        for (int stream = 0; stream < aligned; ++stream) {
+            if (m_alignedFrame.state[stream] == StreamAligner::Missing)
+                continue;
+            m_streamRotations[stream] = QQuaternion(m_alignedFrame.w[stream], m_alignedFrame.x[stream],
+                                                    m_alignedFrame.y[stream], m_alignedFrame.z[stream]);
+            m_streamLive[stream] = true;
+            recordDrawLatency(stream, now, m_alignedFrame.arrivalTime[stream],
+                              m_alignedFrame.sampleTime[stream],
+                              m_alignedFrame.synchronized[stream]);
+        }
+        return;
+    }
+    for (int stream = 0; stream < count; ++stream) {
+        if (sensorRotation(stream, now, &m_streamRotations[stream]))
+            m_streamLive[stream] = true;
+    }
+}
+
+
+// The orientation of a stream is the one its sensor had m_playoutDelay
+// before the frame is expected on screen, taken to be one frame interval
+// from now: interpolated between samples, which trades a fixed latency for
+// smooth motion when packets arrive in bursts, or extrapolated from the
+// newest sample's angular velocity (by at most m_maxPrediction) when that
+// time is past the newest sample.
+// Returns false, leaving rotation alone, if the stream has no data or the
+// ingest thread overwrote what we were reading.
+bool
+Scene::sensorRotation(int stream, qint64 now, QQuaternion *rotation) {
+    JitterBuffer::Interpolation sample;
+    if (!m_sensors.history(stream).interpolate(now + m_frameInterval - m_playoutDelay, &sample))
+        return false;
+    const SensorSample &from = sample.from;
+    const SensorSample &to = sample.to;
+    if (sample.ahead > 0 && m_maxPrediction > 0) {
+        const QuaternionMath::Quaternion q =
+            VelocityEstimator::extrapolate(to, qMin(sample.ahead, m_maxPrediction));
+        *rotation = QQuaternion(q.w, q.x, q.y, q.z);
+    } else {
+        *rotation = QQuaternion::slerp(QQuaternion(from.w, from.x, from.y, from.z),
+                                       QQuaternion(to.w, to.x, to.y, to.z),
+                                       sample.t);
+    }
+    recordDrawLatency(stream, now, to.arrivalTime, to.sampleTime, to.synchronized);
+    return true;
+}
+
+
+// The first time a sample is drawn, directly or as the newer end of an
+// interpolation, its age is recorded in m_arrivalToDraw and, if its
+// sender's clock is synchronized, in m_captureToDraw.
+void
+Scene::recordDrawLatency(int stream, qint64 now, qint64 arrivalTime, qint64 sampleTime,
+                         bool synchronized) {
+    if (arrivalTime == 0 || arrivalTime <= m_lastDrawnArrival[stream])
+        return;
+    m_arrivalToDraw.record(now - arrivalTime);
+    if (synchronized)
+        m_captureToDraw.record(now - sampleTime);
+    m_lastDrawnArrival[stream] = arrivalTime;
+}
+
+
+void
+Scene::setPlayoutDelay(int milliseconds) {
+    m_playoutDelay = qint64(qMax(0, milliseconds)) * 1000000;
+}
+
+
+void
+Scene::setMaxPrediction(int milliseconds) {
+    m_maxPrediction = qint64(qMax(0, milliseconds)) * 1000000;
+}
+
+
+// The tare itself is taken by the ingest threads from the next sample of
+// each stream, if it comes soon enough; the file is saved once it is.
+void
+Scene::tareSensors() {
+    for (int id = 0; id < m_sensors.streamCount(); ++id) {
+        if (m_sensors.isLive(id))
+            m_sensors.requestTare(id);
+    }
+}
+
+
+void
+Scene::clearTare() {
+    for (int id = 0; id < SensorTable::Capacity; ++id) {
+        Calibration calibration = m_sensors.calibration(id);
+        calibration.reference = Calibration().reference;
+        m_sensors.setCalibration(id, calibration);
+    }
+    saveCalibration();
+}
+
+
+void
+Scene::saveCalibration() {
+    m_savedReferences = m_sensors.referenceCount();
+    if (m_calibrationFile.isEmpty())
+        return;
+    QDir().mkpath(QFileInfo(m_calibrationFile).absolutePath());
+    if (!Calibrator::save(m_calibrationFile, m_sensors))
+        qWarning() << "Unable to save the sensor calibrations to" << m_calibrationFile;
+}
+
+
 void
 Scene::drawBackground(QPainter *painter, const QRectF &) {
     float width = float(painter->device()->width());
     float height = float(painter->device()->height());
     painter->beginNativePainting();
+    updateSensorRotations();
     setStates();
     if (m_dynamicCubemap)
         renderCubemaps();
@@ -635,23 +1050,6 @@ Scene::newItem(ItemDialog::ItemType type) {
 }
 
 
-void
-Scene::onReadPendingDatagrams() {
-    while(pUdpSocket->hasPendingDatagrams()) {
-        QNetworkDatagram datagram = pUdpSocket->receiveDatagram();
-        QByteArray received = datagram.data();
-        if(received.size() != 4*sizeof(float))
-            qDebug() << "Size differs";
-        else {
-            memcpy(&q0, received.constData(),    4);
-            memcpy(&q1, received.constData()+4,  4);
-            memcpy(&q2, received.constData()+8,  4);
-            memcpy(&q3, received.constData()+12, 4);
-        }
-    }
-}
-
-
 void
 Scene::onChangeTexture() {
     currentTexture += 1;
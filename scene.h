@@ -58,9 +58,18 @@
 #include "trackball.h"
 #include "itemdialog.h"
 #include "renderoptionsdialog.h"
+#include "samplerecorder.h"
+#include "latencyhistogram.h"
+#include "sensoroptions.h"
+#include "sensorreceiver.h"
+#include "sensorrelay.h"
+#include "sensortable.h"
+#include "serialsource.h"
+#include "sharedmemorysource.h"
+#include "streamaligner.h"
 
 #include <QtWidgets>
-#include <QUdpSocket>
+#include <QThread>
 #include <QTimer>
 
 
@@ -73,9 +82,17 @@ class Scene : public QGraphicsScene
 {
     Q_OBJECT
 public:
-    Scene(int width, int height, int maxTextureSize);
+    Scene(int width, int height, int maxTextureSize, const SensorOptions &options = SensorOptions());
     ~Scene();
     void drawBackground(QPainter *painter, const QRectF &rect) override;
+    // Time from kernel arrival of a sensor sample to the first frame that draws it.
+    const LatencyHistogram &arrivalToDrawLatency() const { return m_arrivalToDraw; }
+    // Time from capture of a sensor sample, for senders whose clock is
+    // synchronized with ours, to the first frame that draws it.
+    const LatencyHistogram &captureToDrawLatency() const { return m_captureToDraw; }
+    // Per-stream and per-socket ingest counters.
+    const SensorTable &sensors() const { return m_sensors; }
+    ReceiverStatistics receiverStatistics() const;
 
 public slots:
     void setShader(int index);
@@ -84,15 +101,23 @@ public slots:
     void setColorParameter(const QString &name, QRgb color);
     void setFloatParameter(const QString &name, float value);
     void newItem(ItemDialog::ItemType type);
-    void onReadPendingDatagrams();
     void onChangeTexture();
+    void setPlayoutDelay(int milliseconds);
+    void setMaxPrediction(int milliseconds);
+    // Takes the current pose of every live sensor as its zero, or goes
+    // back to the raw orientations; either way the calibration file is
+    // updated.
+    void tareSensors();
+    void clearTare();
 
 protected:
     void renderBoxes(const QMatrix4x4 &view, int excludeBox = -2);
+    void renderSensorBoxes(const QMatrix4x4 &view, const QMatrix4x4 &invView);
     void setStates();
     void setLights();
     void defaultStates();
     void renderCubemaps();
+    void saveCalibration();
 
     void mousePressEvent(QGraphicsSceneMouseEvent *event) override;
     void mouseReleaseEvent(QGraphicsSceneMouseEvent *event) override;
@@ -101,6 +126,11 @@ protected:
 
 private:
     void initGL();
+    void startReceiver(SensorReceiver *receiver);
+    void updateSensorRotations();
+    bool sensorRotation(int stream, qint64 now, QQuaternion *rotation);
+    void recordDrawLatency(int stream, qint64 now, qint64 arrivalTime, qint64 sampleTime,
+                           bool synchronized);
     QPointF pixelPosToViewPos(const QPointF& p);
 
     int m_lastTime;
@@ -130,9 +160,32 @@ private:
     QGLShader *m_environmentShader;
     QGLShaderProgram *m_environmentProgram;
 
-    QUdpSocket*  pUdpSocket;
-    int          udpPort;
-    float        q0, q1, q2, q3;
+    SensorTable          m_sensors;
+    // One receiver per ingest thread, all sharing the UDP port.
+    QVector<QThread *>   m_ingestThreads;
+    QVector<SensorReceiver *> m_receivers;
+    SharedMemorySource*  m_sharedMemory;
+    QString              m_calibrationFile;
+    // SensorTable::referenceCount() when the calibrations were last saved.
+    quint32              m_savedReferences;
+    SerialSource*        m_serial;
+    SensorRelay*         m_relay;
+    SampleRecorder*      m_recorder;
+    // When all streams are drawn from common frames, and the newest one.
+    StreamAligner*       m_aligner;
+    StreamAligner::Frame m_alignedFrame;
+    // Per sensor stream: orientation for the current frame, whether the
+    // stream has data, and the arrival time of the newest sample drawn.
+    QVector<QQuaternion> m_streamRotations;
+    QVector<bool>        m_streamLive;
+    QVector<qint64>      m_lastDrawnArrival;
+    qint64               m_playoutDelay;
+    qint64               m_maxPrediction;
+    qint64               m_lastFrameTime;
+    qint64               m_frameInterval;
+    LatencyHistogram     m_arrivalToDraw;
+    LatencyHistogram     m_captureToDraw;
+    int                  udpPort;
     int          nTextures;
     int          currentTexture;
     QTimer       timerTexture;
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+#include <time.h>
+#else
+#include <QDateTime>
+#endif
+
+
+// Wall clock in nanoseconds, the same time base the kernel uses for
+// SO_TIMESTAMPNS receive timestamps.
+namespace SensorClock
+{
+    inline qint64 now() {
+#ifdef Q_OS_LINUX
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#else
+        return QDateTime::currentMSecsSinceEpoch() * 1000000;
+#endif
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "admissioncontrol.h"
+#include "orientationfilter.h"
+
+#include <QString>
+#include <QVector>
+
+
+// Sensor ingest settings, filled from the command line in main().
+struct SensorOptions
+{
+    quint16 udpPort = 3333;
+    // IPv4 or IPv6 multicast group to receive the UDP port's samples from
+    // as well, and the network interface to join it on; empty for none,
+    // or for the system's choice of interface.
+    QString multicastGroup;
+    QString multicastInterface;
+    // Hosts and subnets allowed to send to the UDP ports, all if empty,
+    // and how many datagrams per second each source may send; 0 for no
+    // limit.
+    QVector<AdmissionControl::Subnet> allowedSources;
+    int sourceRate = 5000;
+    // Extra UDP port for OSC tools, which may also send to udpPort; 0 for
+    // none.
+    quint16 oscPort = 0;
+    // How far behind real time the main box is drawn, in milliseconds.
+    // A few packet intervals let the jitter buffer interpolate through
+    // bursts; 0 always draws the newest sample.
+    int playoutDelay = 0;
+    // Upper bound, in milliseconds, on how far past the newest sample the
+    // orientation is extrapolated to meet the expected scanout time of a
+    // frame. 0 disables prediction.
+    int maxPrediction = 0;
+    // Frames per second all the streams are resampled together at (see
+    // StreamAligner), and drawn from instead of the playout delay and
+    // prediction above; 0 for none. How old, in milliseconds, each frame's
+    // time is when it is made.
+    int alignRate = 0;
+    int alignDelay = 20;
+    // Filters every sample goes through on ingest, in order; none by
+    // default.
+    QVector<OrientationFilter::Stage> filters;
+    // File the per-sensor calibrations are loaded from at startup and
+    // saved to when they change (see Calibrator).
+    QString calibrationFile;
+    // Name of a POSIX shared-memory ring a local sensor bridge writes
+    // into (see SharedMemoryRing); empty for none.
+    QString sharedMemory;
+    // Path of a Unix-domain SOCK_SEQPACKET socket local producers can
+    // connect to; empty for none.
+    QString localSocket;
+    // Serial device sensors are wired to, and its baud rate; empty for
+    // none.
+    QString serialDevice;
+    int serialBaudRate = 921600;
+    // UDP port to forward the samples to subscribed viewers from, and how
+    // many updates per second they get; 0 for no relay.
+    quint16 relayPort = 0;
+    int relayRate = 60;
+    // File every accepted sample is recorded to (see SampleRecorder);
+    // empty for none.
+    QString recordFile;
+    // Relay to receive the samples of another host's sensors from, as
+    // well; empty for none.
+    QString subscribeHost;
+    quint16 subscribePort = 0;
+    // Number of ingest threads sharing the UDP port with SO_REUSEPORT,
+    // each receiving from its own subset of the senders.
+    int ingestThreads = 1;
+    // Spin on the UDP socket instead of waiting for it, trading a core for
+    // lower and steadier ingest latency.
+    bool busyPoll = false;
+    // CPU to pin the first ingest thread to, the others going to the
+    // following CPUs, or -1 for none.
+    int ingestCpu = -1;
+    // SCHED_FIFO priority of the ingest threads, or 0 for normal scheduling.
+    int realtimePriority = 0;
+};
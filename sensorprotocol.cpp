@@ -0,0 +1,293 @@
+#include "sensorprotocol.h"
+
+#include <QtEndian>
+
+#include <cmath>
+#include <cstring>
+
+
+static void
+readOrientation(const char *data, SensorSample *sample) {
+    memcpy(&sample->w, data,    4);
+    memcpy(&sample->x, data+4,  4);
+    memcpy(&sample->y, data+8,  4);
+    memcpy(&sample->z, data+12, 4);
+}
+
+
+// Reads the sensor ID, sequence number and sender timestamp that start
+// every batch record.
+static void
+readRecordHeader(const char *data, SensorSample *sample) {
+    *sample = SensorSample();
+    sample->sensorId = qFromLittleEndian<quint16>(data);
+    sample->sequence = qFromLittleEndian<quint32>(data+4);
+    sample->sequenced = true;
+    sample->senderTime = qFromLittleEndian<qint64>(data+8);
+    sample->senderTimed = true;
+}
+
+
+// Decodes n smallest-three orientations of bits bits per component from
+// words of wordBits bits, the index of the largest component in their top
+// two bits, which must have room for DecodeLanes, into samples. Unpacking and
+// reconstruction are separate loops without branches over a multiple of 8
+// words, so that the compiler can vectorize them.
+enum { DecodeLanes = SensorProtocol::MaxSamples + 1 };
+
+static void
+decodeSmallestThree(quint64 *words, int wordBits, int bits, int n, SensorSample *samples) {
+    qint32 largest[DecodeLanes], a[DecodeLanes], b[DecodeLanes], c[DecodeLanes];
+    float w[DecodeLanes], x[DecodeLanes], y[DecodeLanes], z[DecodeLanes];
+    const int padded = (n + 7) & ~7;
+    for(int i = n; i < padded; ++i)
+        words[i] = 0;
+    const quint64 mask = (quint64(1) << bits) - 1;
+    for(int i = 0; i < padded; ++i) {
+        largest[i] = qint32(words[i] >> (wordBits - 2)) & 3;
+        a[i] = qint32((words[i] >> (2 * bits)) & mask);
+        b[i] = qint32((words[i] >> bits) & mask);
+        c[i] = qint32(words[i] & mask);
+    }
+    const float scale = float(M_SQRT2) / mask;
+    const float offset = float(M_SQRT1_2);
+    for(int i = 0; i < padded; ++i) {
+        const float fa = a[i] * scale - offset;
+        const float fb = b[i] * scale - offset;
+        const float fc = c[i] * scale - offset;
+        // Quantization can push the sum of squares slightly past one.
+        const float dd = 1.0f - fa * fa - fb * fb - fc * fc;
+        const float d = std::sqrt(dd > 0.0f ? dd : 0.0f);
+        // Put d in place of the largest component and shift the others
+        // past it, with arithmetic selects rather than branches.
+        const qint32 l = largest[i];
+        const float is0 = l == 0 ? 1.0f : 0.0f;
+        const float is1 = l == 1 ? 1.0f : 0.0f;
+        const float is2 = l == 2 ? 1.0f : 0.0f;
+        const float is3 = l == 3 ? 1.0f : 0.0f;
+        w[i] = fa + is0 * (d - fa);
+        x[i] = fb + is0 * (fa - fb) + is1 * (d - fb);
+        y[i] = fc + (is0 + is1) * (fb - fc) + is2 * (d - fc);
+        z[i] = fc + is3 * (d - fc);
+    }
+    for(int i = 0; i < n; ++i) {
+        samples[i].w = w[i];
+        samples[i].x = x[i];
+        samples[i].y = y[i];
+        samples[i].z = z[i];
+    }
+}
+
+
+// Reads the n orientations, stride bytes apart, that start at data.
+static void
+readOrientations(const char *data, int stride, int encoding, int n, SensorSample *samples) {
+    using namespace SensorProtocol;
+    quint64 words[DecodeLanes];
+    switch(encoding) {
+    case Float:
+        for(int i = 0; i < n; ++i)
+            readOrientation(data + i * stride, &samples[i]);
+        break;
+    case SmallestThree32:
+        for(int i = 0; i < n; ++i)
+            words[i] = qFromLittleEndian<quint32>(data + i * stride);
+        decodeSmallestThree(words, 32, 10, n, samples);
+        break;
+    case SmallestThree48:
+        for(int i = 0; i < n; ++i) {
+            const char *word = data + i * stride;
+            words[i] = qFromLittleEndian<quint32>(word)
+                     | quint64(qFromLittleEndian<quint16>(word+4)) << 32;
+        }
+        decodeSmallestThree(words, 48, 15, n, samples);
+        break;
+    }
+}
+
+
+static SensorProtocol::Status
+parseBatch(const char *data, int size, int encoding, SensorSample *samples, int *count) {
+    using namespace SensorProtocol;
+    const int recordSize = RecordHeaderSize + orientationSize(encoding);
+    const int n = size / recordSize;
+    if(size % recordSize != 0 || n == 0 || n > MaxSamples)
+        return Malformed;
+    for(int i = 0; i < n; ++i)
+        readRecordHeader(data + i * recordSize, &samples[i]);
+    readOrientations(data + RecordHeaderSize, recordSize, encoding, n, samples);
+    *count = n;
+    return Ok;
+}
+
+
+static SensorProtocol::Status
+parseImuBatch(const char *data, int size, SensorSample *samples,
+              SensorProtocol::ImuReading *readings, int *count) {
+    using namespace SensorProtocol;
+    const int n = size / ImuRecordSize;
+    if(size % ImuRecordSize != 0 || n == 0 || n > MaxSamples)
+        return Malformed;
+    for(int i = 0; i < n; ++i, data += ImuRecordSize) {
+        readRecordHeader(data, &samples[i]);
+        samples[i].fused = true;
+        memcpy(&readings[i], data+RecordHeaderSize, sizeof(ImuReading));
+    }
+    *count = n;
+    return Ok;
+}
+
+
+int
+SensorProtocol::orientationSize(int encoding) {
+    switch(encoding) {
+    case Float:
+        return OrientationSize;
+    case SmallestThree32:
+        return 4;
+    case SmallestThree48:
+        return 6;
+    default:
+        return 0;
+    }
+}
+
+
+int
+SensorProtocol::packetType(const char *data, int size) {
+    if(size < HeaderSize || data[0] != 'A' || data[1] != 'R' || quint8(data[2]) != Version)
+        return 0;
+    return quint8(data[3]);
+}
+
+
+bool
+SensorProtocol::isTimeRequest(const char *data, int size) {
+    return size >= HeaderSize && data[0] == 'A' && data[1] == 'R'
+           && quint8(data[2]) == Version && quint8(data[3]) == TimeRequest;
+}
+
+
+SensorProtocol::Status
+SensorProtocol::answerTimeRequest(const char *data, int size, qint64 receiveTime,
+                                  qint64 transmitTime, ClockRequest *request, char *response) {
+    if(size != TimeRequestSize)
+        return Malformed;
+    request->sensorId = qFromLittleEndian<quint16>(data+4);
+    request->sensorCount = qMax<quint16>(1, qFromLittleEndian<quint16>(data+6));
+    request->previous.origin = qFromLittleEndian<qint64>(data+20);
+    request->previous.receive = qFromLittleEndian<qint64>(data+28);
+    request->previous.transmit = qFromLittleEndian<qint64>(data+36);
+    request->previous.arrival = qFromLittleEndian<qint64>(data+44);
+    memcpy(response, data, HeaderSize);
+    response[3] = char(TimeResponse);
+    memcpy(response+HeaderSize, data+HeaderSize, sizeof(qint64));
+    qToLittleEndian<qint64>(receiveTime, response+20);
+    qToLittleEndian<qint64>(transmitTime, response+28);
+    return Ok;
+}
+
+
+SensorProtocol::Status
+SensorProtocol::parse(const char *data, int size, SensorSample *samples,
+                      ImuReading *readings, int *count) {
+    *count = 0;
+    SensorSample *sample = samples;
+    *sample = SensorSample();
+    const bool versioned = size >= HeaderSize && data[0] == 'A' && data[1] == 'R'
+                           && quint8(data[2]) == Version;
+    if(!versioned && size == LegacyPacketSize) {
+        sample->sensorId = 0;
+        readOrientation(data, sample);
+        *count = 1;
+        return Ok;
+    }
+    if(!versioned && size == AddressedPacketSize) {
+        sample->sensorId = qFromLittleEndian<quint16>(data);
+        readOrientation(data+4, sample);
+        *count = 1;
+        return Ok;
+    }
+    if(size < HeaderSize || data[0] != 'A' || data[1] != 'R')
+        return Malformed;
+    if(quint8(data[2]) != Version)
+        return UnsupportedVersion;
+    const int encoding = qFromLittleEndian<quint16>(data+6);
+    if(orientationSize(encoding) == 0)
+        return Malformed;
+    switch(quint8(data[3])) {
+    case Orientation:
+        if(size != HeaderSize + orientationSize(encoding))
+            return Malformed;
+        sample->sensorId = qFromLittleEndian<quint16>(data+4);
+        sample->sequence = qFromLittleEndian<quint32>(data+8);
+        sample->sequenced = true;
+        readOrientations(data+HeaderSize, 0, encoding, 1, sample);
+        *count = 1;
+        return Ok;
+    case OrientationBatch:
+        return parseBatch(data+HeaderSize, size-HeaderSize, encoding, samples, count);
+    case ImuBatch:
+        if(encoding != Float)
+            return Malformed;
+        return parseImuBatch(data+HeaderSize, size-HeaderSize, samples, readings, count);
+    default:
+        return Malformed;
+    }
+}
+
+
+void
+SensorProtocol::writeHeader(char *packet, PacketType type, quint16 sensorId,
+                            Encoding encoding, quint32 sequence) {
+    packet[0] = 'A';
+    packet[1] = 'R';
+    packet[2] = char(Version);
+    packet[3] = char(type);
+    qToLittleEndian<quint16>(sensorId, packet+4);
+    qToLittleEndian<quint16>(quint16(encoding), packet+6);
+    qToLittleEndian<quint32>(sequence, packet+8);
+}
+
+
+void
+SensorProtocol::writeSubscription(char *packet, PacketType type, quint64 cookie) {
+    writeHeader(packet, type);
+    qToLittleEndian<quint64>(cookie, packet+HeaderSize);
+}
+
+
+quint64
+SensorProtocol::subscriptionCookie(const char *packet) {
+    return qFromLittleEndian<quint64>(packet+HeaderSize);
+}
+
+
+void
+SensorProtocol::writeRecord(char *record, const SensorSample &sample, quint32 sequence) {
+    qToLittleEndian<quint16>(sample.sensorId, record);
+    qToLittleEndian<quint16>(0, record+2);
+    qToLittleEndian<quint32>(sequence, record+4);
+    qToLittleEndian<qint64>(sample.sampleTime, record+8);
+
+    // Leave the largest component out, made positive, and quantize the
+    // others in order below its index, in bits 46-47.
+    const float q[4] = { sample.w, sample.x, sample.y, sample.z };
+    int largest = 0;
+    for(int i = 1; i < 4; ++i) {
+        if(std::fabs(q[i]) > std::fabs(q[largest]))
+            largest = i;
+    }
+    const float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+    const quint64 mask = (quint64(1) << 15) - 1;
+    quint64 word = 0;
+    for(int i = 0; i < 4; ++i) {
+        if(i == largest)
+            continue;
+        const float scaled = (sign * q[i] + float(M_SQRT1_2)) * float(mask / M_SQRT2);
+        word = word << 15 | quint64(qBound(0.0f, std::round(scaled), float(mask)));
+    }
+    word |= quint64(largest) << 46;
+    qToLittleEndian<quint32>(quint32(word), record+RecordHeaderSize);
+    qToLittleEndian<quint16>(quint16(word >> 32), record+RecordHeaderSize+4);
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include "sensorsample.h"
+
+
+// Wire format of the sensor datagrams.
+//
+// Versioned packets start with a 12-byte little-endian header:
+//
+//    0  quint8[2]  magic, "AR"
+//    2  quint8     version, 1
+//    3  quint8     packet type (PacketType)
+//    4  quint16    sensor ID
+//    6  quint16    orientation encoding (Encoding), zero for ImuBatch
+//    8  quint32    sequence number, incremented by one per packet and
+//                  sensor, wrapping around
+//
+// followed by the payload, which depends on the packet type:
+//
+//  - Orientation: the orientation of one sample.
+//  - OrientationBatch: header sensor ID and sequence are ignored; the
+//    payload is 1 to MaxSamples records for one or several sensors, in the
+//    order they are to be ingested:
+//
+//       0  quint16  sensor ID
+//       2  quint16  reserved, zero
+//       4  quint32  sequence number of that sensor
+//       8  qint64   sender timestamp, nanoseconds on the sender's clock
+//      16           orientation
+//
+// Orientations are encoded as the header says, which lets each sender
+// trade precision for bandwidth:
+//
+//  - Float: the four native-endian floats w, x, y, z, 16 bytes.
+//  - SmallestThree32, SmallestThree48: a little-endian 32-bit word, or
+//    48-bit word stored in 6 bytes. The two top bits (bits 30-31, or 46-47)
+//    are the index (w, x, y, z) of the component with the largest
+//    magnitude, which is left out; q and -q being the same rotation, it is
+//    made positive first. The other three components are in order in the
+//    low 30 or 45 bits, 10 or 15 bits each, the last one in the low bits,
+//    each quantized from [-1/sqrt(2), 1/sqrt(2)] to [0, 2^bits - 1]. Bit
+//    45 of the 48-bit word is zero.
+//
+//  - ImuBatch: like OrientationBatch, for sensors that cannot fuse their
+//    own orientation. Records are ImuRecordSize bytes:
+//
+//       0  quint16  sensor ID
+//       2  quint16  reserved, zero
+//       4  quint32  sequence number of that sensor
+//       8  qint64   sender timestamp, nanoseconds on the sender's clock
+//      16  float[3] angular rate, radians per second
+//      28  float[3] acceleration, any unit
+//      40  float[3] magnetic field, any unit, or all zero if there is none
+//
+//    all in the sensor frame, which the orientation is fused from on
+//    ingest (see ImuFusion).
+//
+// Senders that timestamp their samples can have their clock mapped onto
+// ours (see ClockSync) with an NTP-style exchange on the same port. The
+// sender sends a TimeRequest, header sensor ID the first of its sensors,
+// header encoding field the number of consecutive sensor IDs from there
+// that share its clock (0 meaning 1, at most ClockSync::MaxSensors), and a
+// TimeRequestSize payload of
+// qint64 nanoseconds:
+//
+//       0  transmit time of this request, sender's clock
+//       8  origin, receive and transmit times of the last TimeResponse
+//          received, copied from it
+//      32  arrival time of that response, sender's clock
+//
+// the last four zero if there was none yet. We answer at once with a
+// TimeResponse, its header that of the request with the type changed, and
+// a TimeResponseSize payload:
+//
+//       0  origin: transmit time of the request, copied from it
+//       8  receive time of the request, our clock
+//      16  transmit time of this response, our clock
+//
+// The previous exchange carried by each request is the one that the
+// clock mapping is estimated from, so we keep no state per exchange.
+//
+// Viewers have a relay (see SensorRelay) forward them the samples it
+// receives by sending it a Subscribe at least every
+// SensorRelay::SubscriptionTimeout, and an Unsubscribe when they leave.
+// Both are a header with all fields zero and an 8-byte cookie, first zero.
+// The relay answers a request whose cookie it did not issue to that
+// address with a Challenge of the same size carrying the right cookie,
+// which the viewer sends with its requests from then on; so the relay
+// only ever sends samples to an address that can receive its packets,
+// and never more than it was sent to one that has not. It sends its
+// OrientationBatch packets, encoded SmallestThree48, back to the address
+// the requests came from.
+//
+// Two unversioned formats are still accepted (a 16-byte SmallestThree32
+// Orientation packet is told apart from a legacy one by its header):
+//  - legacy, 16 bytes: the four floats alone, always sensor 0;
+//  - addressed, 20 bytes: quint16 sensor ID, quint16 reserved, then the
+//    four floats.
+namespace SensorProtocol
+{
+    enum {
+        Version = 1,
+        HeaderSize = 12,
+        OrientationSize = 4 * sizeof(float),
+        LegacyPacketSize = OrientationSize,
+        AddressedPacketSize = 4 + OrientationSize,
+        RecordHeaderSize = 16,
+        RecordSize = RecordHeaderSize + OrientationSize,
+        ImuRecordSize = RecordHeaderSize + 9 * sizeof(float),
+        MaxSamples = 63,
+        TimeRequestSize = HeaderSize + 5 * sizeof(qint64),
+        TimeResponseSize = HeaderSize + 3 * sizeof(qint64),
+        SubscriptionSize = HeaderSize + sizeof(quint64)
+    };
+
+    enum PacketType {
+        Orientation = 1,
+        OrientationBatch = 2,
+        ImuBatch = 3,
+        TimeRequest = 4,
+        TimeResponse = 5,
+        Subscribe = 6,
+        Unsubscribe = 7,
+        Challenge = 8
+    };
+
+    enum Encoding {
+        Float = 0,
+        SmallestThree32 = 1,
+        SmallestThree48 = 2
+    };
+
+    // Size of one orientation in encoding, or 0 for unknown encodings.
+    int orientationSize(int encoding);
+
+    enum Status {
+        Ok,
+        Malformed,
+        UnsupportedVersion
+    };
+
+    // Raw readings of one ImuBatch record.
+    struct ImuReading
+    {
+        float gyro[3];
+        float accel[3];
+        float magnet[3];
+    };
+
+    // The four timestamps of one request and response: t1 to t4 in NTP
+    // terms, origin and arrival on the sender's clock, the others on ours.
+    struct ClockExchange
+    {
+        qint64 origin = 0;
+        qint64 receive = 0;
+        qint64 transmit = 0;
+        qint64 arrival = 0;
+    };
+
+    struct ClockRequest
+    {
+        quint16 sensorId = 0;
+        quint16 sensorCount = 1;
+        // The previous exchange, all zero if there was none.
+        ClockExchange previous;
+    };
+
+    // Packet type of a versioned packet, 0 for anything else.
+    int packetType(const char *data, int size);
+
+    bool isTimeRequest(const char *data, int size);
+    // Parses a TimeRequest into request and writes the TimeResponse
+    // answering it into response, which must have room for
+    // TimeResponseSize, stamped with our receive and transmit times.
+    Status answerTimeRequest(const char *data, int size, qint64 receiveTime, qint64 transmitTime,
+                             ClockRequest *request, char *response);
+
+    // Parses in place, without copying the datagram anywhere first, into
+    // samples and readings, which must have room for MaxSamples each. On
+    // success count is the number of samples found. Samples of ImuBatch
+    // packets are flagged fused and their readings are filled in; their
+    // orientation is left for ImuFusion.
+    Status parse(const char *data, int size, SensorSample *samples,
+                 ImuReading *readings, int *count);
+
+    // Writes a header into packet, which must have room for HeaderSize.
+    void writeHeader(char *packet, PacketType type, quint16 sensorId = 0,
+                     Encoding encoding = Float, quint32 sequence = 0);
+    // Writes a Subscribe, Unsubscribe or Challenge with cookie into packet,
+    // which must have room for SubscriptionSize.
+    void writeSubscription(char *packet, PacketType type, quint64 cookie);
+    // The cookie of a Subscribe, Unsubscribe or Challenge.
+    quint64 subscriptionCookie(const char *packet);
+    // Writes the SmallestThree48 batch record of sample, with sequence
+    // and its sampleTime as the sender timestamp, into record, which must
+    // have room for RecordHeaderSize + 6.
+    void writeRecord(char *record, const SensorSample &sample, quint32 sequence);
+}
@@ -0,0 +1,524 @@
+#include "sensorreceiver.h"
+#include "hotlog.h"
+#include "sensorclock.h"
+#include "threadtuning.h"
+
+#include <QUdpSocket>
+#include <QHostInfo>
+#include <QNetworkDatagram>
+#include <QNetworkInterface>
+#include <QSocketNotifier>
+#include <QCoreApplication>
+#include <QThread>
+#include <QTimer>
+#include <QDebug>
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef Q_OS_LINUX
+// How long the kernel may busy-wait for packets on a read from a
+// busy-polling socket, in microseconds.
+static const int BusyPollTime = 50;
+// Polls between two looks at the event loop, which serves local
+// connections and the thread's quit().
+static const int PollsPerEventCheck = 1024;
+#endif
+// How often a relay subscription is renewed, in milliseconds; well within
+// SensorRelay::SubscriptionTimeout, so that a lost request or two does not
+// end it.
+static const int SubscriptionInterval = 1000;
+
+
+//============================================================================//
+//                               SensorReceiver                               //
+//============================================================================//
+
+SensorReceiver::SensorReceiver(SensorTable *table, QObject *parent)
+    : QObject(parent)
+    , m_socket(nullptr)
+    , m_subscriptionTimer(nullptr)
+    , m_relayPort(0)
+    , m_relayCookie(0)
+#ifdef Q_OS_LINUX
+    , m_fd(-1)
+    , m_notifier(nullptr)
+    , m_batch(new DatagramBatch)
+    , m_relaySocketAddressLength(0)
+    , m_localFd(-1)
+    , m_localNotifier(nullptr)
+#endif
+    , m_busyPoll(false)
+    , m_cpu(-1)
+    , m_realtimePriority(0)
+    , m_handler(table)
+{
+}
+
+
+SensorReceiver::~SensorReceiver() {
+    if (m_subscriptionTimer)
+        sendSubscription(SensorProtocol::Unsubscribe);
+#ifdef Q_OS_LINUX
+    delete m_notifier;
+    if (m_fd >= 0)
+        close(m_fd);
+    for (const LocalConnection &connection : qAsConst(m_localConnections)) {
+        delete connection.notifier;
+        close(connection.fd);
+    }
+    delete m_localNotifier;
+    if (m_localFd >= 0) {
+        close(m_localFd);
+        unlink(m_localPath.toLocal8Bit().constData());
+    }
+    delete m_batch;
+#endif
+}
+
+
+// Must be called before the receiver is moved to its thread. Receivers
+// bound shared split the datagrams sent to port between them, each sender
+// address always going to the same one.
+bool
+SensorReceiver::bind(quint16 port, bool shared) {
+#ifdef Q_OS_LINUX
+    m_fd = DatagramBatch::openSocket(port, shared);
+    if (m_fd >= 0) {
+        if (!DatagramBatch::enableTimestamps(m_fd))
+            qWarning() << "SO_TIMESTAMPNS unavailable, stamping samples in user space";
+        if (!DatagramBatch::enableDropCount(m_fd))
+            qWarning() << "SO_RXQ_OVFL unavailable, kernel drops will not be counted";
+        if (!m_busyPoll) {
+            m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+            connect(m_notifier, &QSocketNotifier::activated,
+                    this, &SensorReceiver::onSocketActivated);
+        } else if (setsockopt(m_fd, SOL_SOCKET, SO_BUSY_POLL,
+                              &BusyPollTime, sizeof(BusyPollTime)) != 0) {
+            qWarning() << "SO_BUSY_POLL unavailable, spinning in user space only:"
+                       << strerror(errno);
+        }
+        return true;
+    }
+    qWarning() << "Native UDP socket unavailable, falling back to QUdpSocket";
+#endif
+    return bindFallback(port, shared);
+}
+
+
+// Listens for local producers on a Unix-domain SOCK_SEQPACKET socket at
+// path, readable and writable by owner and group only. Must be called
+// before the receiver is moved to its thread.
+bool
+SensorReceiver::listenLocal(const QString &path) {
+#ifdef Q_OS_LINUX
+    const QByteArray name = path.toLocal8Bit();
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (name.size() >= int(sizeof(address.sun_path))) {
+        qWarning() << "Local socket path too long:" << path;
+        return false;
+    }
+    memcpy(address.sun_path, name.constData(), name.size());
+    m_localFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_localFd < 0) {
+        qWarning() << "Unable to create local socket:" << strerror(errno);
+        return false;
+    }
+    // A socket file left over by a previous run would make bind() fail.
+    unlink(name.constData());
+    if (::bind(m_localFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+            || chmod(name.constData(), 0660) != 0
+            || listen(m_localFd, MaxLocalConnections) != 0) {
+        qWarning() << "Unable to listen on" << path << ":" << strerror(errno);
+        close(m_localFd);
+        m_localFd = -1;
+        return false;
+    }
+    m_localPath = path;
+    m_localNotifier = new QSocketNotifier(m_localFd, QSocketNotifier::Read, this);
+    connect(m_localNotifier, &QSocketNotifier::activated,
+            this, &SensorReceiver::onLocalConnection);
+    return true;
+#else
+    Q_UNUSED(path);
+    qWarning() << "Local sensor sockets are only available on Linux";
+    return false;
+#endif
+}
+
+
+// Joins the IPv4 or IPv6 multicast group, on the named network interface
+// or, if interfaceName is empty, the one the system picks. Must be called
+// after bind().
+bool
+SensorReceiver::joinMulticast(const QString &group, const QString &interfaceName) {
+#ifdef Q_OS_LINUX
+    if (m_fd >= 0) {
+        const QByteArray address = group.toLatin1();
+        unsigned index = 0;
+        if (!interfaceName.isEmpty()) {
+            index = if_nametoindex(interfaceName.toLocal8Bit().constData());
+            if (index == 0) {
+                qWarning() << "No such network interface:" << interfaceName;
+                return false;
+            }
+        }
+        int result;
+        ip_mreqn request4 = {};
+        ipv6_mreq request6 = {};
+        if (inet_pton(AF_INET, address.constData(), &request4.imr_multiaddr) == 1) {
+            // Also works on the dual-stack IPv6 socket.
+            request4.imr_ifindex = int(index);
+            result = setsockopt(m_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request4, sizeof(request4));
+        } else if (inet_pton(AF_INET6, address.constData(), &request6.ipv6mr_multiaddr) == 1) {
+            request6.ipv6mr_interface = index;
+            result = setsockopt(m_fd, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP, &request6, sizeof(request6));
+        } else {
+            qWarning() << "Not a multicast address:" << group;
+            return false;
+        }
+        if (result != 0) {
+            qWarning() << "Unable to join multicast group" << group << ":" << strerror(errno);
+            return false;
+        }
+        return true;
+    }
+#endif
+    const QHostAddress address(group);
+    if (!address.isMulticast()) {
+        qWarning() << "Not a multicast address:" << group;
+        return false;
+    }
+    if (interfaceName.isEmpty())
+        return m_socket->joinMulticastGroup(address);
+    return m_socket->joinMulticastGroup(address, QNetworkInterface::interfaceFromName(interfaceName));
+}
+
+
+// Subscribes to the SensorRelay listening on port of host, a name or an
+// IPv4 or IPv6 address.
+bool
+SensorReceiver::subscribe(const QString &host, quint16 port) {
+    m_relayAddress = QHostAddress(host);
+    if (m_relayAddress.isNull()) {
+        const QList<QHostAddress> addresses = QHostInfo::fromName(host).addresses();
+        if (addresses.isEmpty()) {
+            qWarning() << "Unable to resolve relay host" << host;
+            return false;
+        }
+        m_relayAddress = addresses.first();
+    }
+    m_relayPort = port;
+#ifdef Q_OS_LINUX
+    if (m_fd >= 0) {
+        // A dual-stack socket reaches IPv4 hosts at their mapped address.
+        int family = AF_INET;
+        socklen_t size = sizeof(family);
+        getsockopt(m_fd, SOL_SOCKET, SO_DOMAIN, &family, &size);
+        m_relaySocketAddress = sockaddr_storage();
+        bool isIPv4 = false;
+        const quint32 ipv4 = m_relayAddress.toIPv4Address(&isIPv4);
+        if (family == AF_INET6) {
+            sockaddr_in6 *address = reinterpret_cast<sockaddr_in6 *>(&m_relaySocketAddress);
+            const Q_IPV6ADDR ipv6 = m_relayAddress.toIPv6Address();
+            address->sin6_family = AF_INET6;
+            address->sin6_port = htons(port);
+            memcpy(&address->sin6_addr, ipv6.c, sizeof(address->sin6_addr));
+            m_relaySocketAddressLength = sizeof(sockaddr_in6);
+        } else if (isIPv4) {
+            sockaddr_in *address = reinterpret_cast<sockaddr_in *>(&m_relaySocketAddress);
+            address->sin_family = AF_INET;
+            address->sin_port = htons(port);
+            address->sin_addr.s_addr = htonl(ipv4);
+            m_relaySocketAddressLength = sizeof(sockaddr_in);
+        } else {
+            qWarning() << "Relay host" << host << "is not reachable over IPv4";
+            return false;
+        }
+    }
+#endif
+    m_subscriptionTimer = new QTimer(this);
+    m_subscriptionTimer->setInterval(SubscriptionInterval);
+    connect(m_subscriptionTimer, &QTimer::timeout,
+            this, [this]() { sendSubscription(SensorProtocol::Subscribe); });
+    return true;
+}
+
+
+// Must be called before bind().
+void
+SensorReceiver::setBusyPoll(bool enabled) {
+#ifdef Q_OS_LINUX
+    m_busyPoll = enabled;
+#else
+    if (enabled)
+        qWarning() << "Busy polling is only available on Linux";
+#endif
+}
+
+
+void
+SensorReceiver::setThreadOptions(int cpu, int realtimePriority) {
+    m_cpu = cpu;
+    m_realtimePriority = realtimePriority;
+}
+
+
+void
+SensorReceiver::setFilters(const QVector<OrientationFilter::Stage> &stages) {
+    m_handler.setFilters(stages);
+}
+
+
+void
+SensorReceiver::setAdmission(const QVector<AdmissionControl::Subnet> &allowed, int rate) {
+    m_admission.setAllowedSources(allowed);
+    m_admission.setRate(rate);
+}
+
+
+void
+SensorReceiver::run() {
+    if (m_cpu >= 0)
+        ThreadTuning::pinToCpu(m_cpu);
+    if (m_realtimePriority > 0)
+        ThreadTuning::setRealtime(m_realtimePriority);
+    if (m_subscriptionTimer) {
+        sendSubscription(SensorProtocol::Subscribe);
+        m_subscriptionTimer->start();
+    }
+#ifdef Q_OS_LINUX
+    if (m_busyPoll && m_fd >= 0)
+        poll();
+#endif
+}
+
+
+bool
+SensorReceiver::bindFallback(quint16 port, bool shared) {
+    m_socket = new QUdpSocket(this);
+    connect(m_socket, &QUdpSocket::readyRead,
+            this, &SensorReceiver::onReadPendingDatagrams);
+    return m_socket->bind(QHostAddress::Any, port,
+                          shared ? QUdpSocket::ShareAddress : QUdpSocket::DefaultForPlatform);
+}
+
+
+void
+SensorReceiver::sendSubscription(SensorProtocol::PacketType type) {
+    char request[SensorProtocol::SubscriptionSize];
+    SensorProtocol::writeSubscription(request, type, m_relayCookie);
+#ifdef Q_OS_LINUX
+    if (m_fd >= 0) {
+        if (sendto(m_fd, request, sizeof(request), MSG_DONTWAIT,
+                   reinterpret_cast<const sockaddr *>(&m_relaySocketAddress),
+                   m_relaySocketAddressLength) < 0)
+            HotLog::log(HotLog::SubscriptionFailed, errno);
+        return;
+    }
+#endif
+    m_socket->writeDatagram(request, sizeof(request), m_relayAddress, m_relayPort);
+}
+
+
+bool
+SensorReceiver::isChallenge(const char *packet, int size) const {
+    return m_subscriptionTimer && size == SensorProtocol::SubscriptionSize
+           && SensorProtocol::packetType(packet, size) == SensorProtocol::Challenge;
+}
+
+
+// Takes the cookie of a Challenge and subscribes with it straight away.
+// Anyone can send a Challenge, so the caller must have checked that it
+// came from the relay.
+void
+SensorReceiver::takeChallenge(const char *packet) {
+    m_relayCookie = SensorProtocol::subscriptionCookie(packet);
+    sendSubscription(SensorProtocol::Subscribe);
+}
+
+
+ReceiverStatistics
+SensorReceiver::statistics() const {
+    ReceiverStatistics result = m_handler.statistics();
+    m_admission.addStatistics(&result);
+    return result;
+}
+
+
+const LatencyHistogram &
+SensorReceiver::ingestLatency() const {
+    return m_ingestLatency;
+}
+
+
+void
+SensorReceiver::onReadPendingDatagrams() {
+    while(m_socket->hasPendingDatagrams()) {
+        QNetworkDatagram datagram = m_socket->receiveDatagram();
+        const qint64 now = SensorClock::now();
+        if (!m_admission.admit(datagram.senderAddress(), now))
+            continue;
+        QByteArray received = datagram.data();
+        if (isChallenge(received.constData(), received.size())) {
+            if (datagram.senderPort() == m_relayPort
+                    && datagram.senderAddress().isEqual(m_relayAddress,
+                                                        QHostAddress::ConvertV4MappedToIPv4))
+                takeChallenge(received.constData());
+            continue;
+        }
+        char reply[SensorProtocol::TimeResponseSize];
+        const int replySize = m_handler.handle(received.constData(), received.size(),
+                                               now, reply);
+        if (replySize > 0)
+            m_socket->writeDatagram(datagram.makeReply(QByteArray(reply, replySize)));
+    }
+}
+
+
+#ifdef Q_OS_LINUX
+void
+SensorReceiver::onSocketActivated() {
+    drain(m_fd, false);
+}
+
+
+void
+SensorReceiver::poll() {
+    QThread *thread = QThread::currentThread();
+    int polls = 0;
+    while (!thread->isInterruptionRequested()) {
+        drain(m_fd, false);
+        if (++polls == PollsPerEventCheck) {
+            polls = 0;
+            QCoreApplication::processEvents();
+        }
+    }
+}
+
+
+// Whether address is the relay's, which m_relaySocketAddress holds in the
+// family of the socket, as the kernel reports the sources of datagrams.
+bool
+SensorReceiver::isRelay(const sockaddr *address) const {
+    const sockaddr *relay = reinterpret_cast<const sockaddr *>(&m_relaySocketAddress);
+    if (address->sa_family != relay->sa_family)
+        return false;
+    if (address->sa_family == AF_INET6) {
+        const sockaddr_in6 *a = reinterpret_cast<const sockaddr_in6 *>(address);
+        const sockaddr_in6 *b = reinterpret_cast<const sockaddr_in6 *>(relay);
+        return a->sin6_port == b->sin6_port
+               && memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0;
+    }
+    const sockaddr_in *a = reinterpret_cast<const sockaddr_in *>(address);
+    const sockaddr_in *b = reinterpret_cast<const sockaddr_in *>(relay);
+    return address->sa_family == AF_INET && a->sin_port == b->sin_port
+           && a->sin_addr.s_addr == b->sin_addr.s_addr;
+}
+
+
+// Drains everything the kernel has queued on fd, a batch at a time.
+// Returns false if fd is a connection whose peer has gone away.
+bool
+SensorReceiver::drain(int fd, bool connected) {
+    int n;
+    do {
+        n = m_batch->receive(fd);
+        const qint64 now = n > 0 ? SensorClock::now() : 0;
+        quint32 drops;
+        if (!connected && n > 0 && m_batch->dropCount(n - 1, &drops))
+            m_handler.setKernelDrops(drops);
+        for (int i = 0; i < n; ++i) {
+            // An empty message on a SOCK_SEQPACKET connection is end of file.
+            if (connected && m_batch->size(i) == 0)
+                return false;
+            // Local connections are already restricted to their owner.
+            if (!connected && !m_admission.admit(m_batch->address(i), now))
+                continue;
+            if (m_batch->truncated(i)) {
+                m_handler.countTruncated();
+                continue;
+            }
+            if (!connected && isChallenge(m_batch->data(i), m_batch->size(i))) {
+                if (isRelay(m_batch->address(i)))
+                    takeChallenge(m_batch->data(i));
+                continue;
+            }
+            const qint64 arrival = m_batch->arrivalTime(i);
+            if (arrival)
+                m_ingestLatency.record(now - arrival);
+            char reply[SensorProtocol::TimeResponseSize];
+            const int replySize = m_handler.handle(m_batch->data(i), m_batch->size(i),
+                                                   arrival ? arrival : now, reply);
+            if (replySize > 0)
+                sendReply(fd, connected, i, reply, replySize);
+        }
+    } while (n == DatagramBatch::Capacity);
+    if (n < 0) {
+        if (connected)
+            return false;
+        HotLog::log(HotLog::ReceiveFailed, errno);
+    }
+    return true;
+}
+
+
+// Answers datagram i of the batch just received on fd. Replies are rare
+// and small, so they are sent one at a time, without waiting.
+void
+SensorReceiver::sendReply(int fd, bool connected, int i, const char *reply, int size) {
+    const ssize_t sent = connected
+            ? send(fd, reply, size, MSG_DONTWAIT | MSG_NOSIGNAL)
+            : sendto(fd, reply, size, MSG_DONTWAIT, m_batch->address(i), m_batch->addressLength(i));
+    if (sent < 0)
+        HotLog::log(HotLog::TimeReplyFailed, errno);
+}
+
+
+void
+SensorReceiver::onLocalConnection() {
+    int fd;
+    while ((fd = accept4(m_localFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (m_localConnections.size() >= MaxLocalConnections) {
+            HotLog::log(HotLog::TooManyLocalConnections);
+            close(fd);
+            continue;
+        }
+        DatagramBatch::enableTimestamps(fd);
+        LocalConnection connection;
+        connection.fd = fd;
+        connection.notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+        connect(connection.notifier, &QSocketNotifier::activated,
+                this, [this, fd]() { onLocalActivated(fd); });
+        m_localConnections.append(connection);
+    }
+}
+
+
+void
+SensorReceiver::onLocalActivated(int fd) {
+    if (drain(fd, true))
+        return;
+    for (int i = 0; i < m_localConnections.size(); ++i) {
+        if (m_localConnections[i].fd == fd) {
+            m_localConnections[i].notifier->setEnabled(false);
+            m_localConnections[i].notifier->deleteLater();
+            close(fd);
+            m_localConnections.removeAt(i);
+            break;
+        }
+    }
+}
+#endif
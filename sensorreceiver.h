@@ -0,0 +1,138 @@
+#pragma once
+
+#include "admissioncontrol.h"
+#include "datagrambatch.h"
+#include "latencyhistogram.h"
+#include "packethandler.h"
+
+#include <QHostAddress>
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+class QSocketNotifier;
+class QTimer;
+class QUdpSocket;
+QT_END_NAMESPACE
+
+
+// Receives orientation datagrams. The receiver is meant to live on its
+// own thread so that a busy GUI event loop never delays a sample; every
+// complete quaternion is published to the stream of its sensor in a
+// SensorTable, which the render path can read without waiting.
+//
+// On Linux the socket is drained in batches with recvmmsg() into a
+// preallocated DatagramBatch and samples carry the kernel receive
+// timestamp; elsewhere, or if the native socket cannot be opened, a
+// QUdpSocket is used instead and samples are stamped when read. Either
+// way the socket can also join a multicast group (joinMulticast()), so
+// that one sensor can feed several viewers.
+//
+// Also on Linux, local producers can connect to a Unix-domain
+// SOCK_SEQPACKET socket instead (listenLocal()), which preserves packet
+// boundaries, skips the IP stack and is protected by file permissions.
+// Its connections are drained in batches the same way.
+//
+// For the lowest and steadiest latency the receiver can instead busy-poll
+// (setBusyPoll()): run() then spins on the non-blocking socket, using
+// SO_BUSY_POLL where available, and only looks at its event loop now and
+// then. That costs a whole core, so pair it with setThreadOptions() to pin
+// the thread to one and optionally make it real-time.
+//
+// Several receivers, each on its own thread, can share one port (bind()
+// with shared set): the kernel then spreads the senders over them, and
+// each publishes the streams it receives straight into the SensorTable.
+//
+// Time requests (see SensorProtocol) are answered on the socket or
+// connection they came in on, so that senders can have their clock
+// synchronized with ours.
+//
+// Datagrams from the network go through an AdmissionControl first,
+// which drops those from sources not allowed or over their rate before
+// they are parsed (setAdmission()).
+//
+// Instead of, or as well as, receiving from sensors, the receiver can
+// subscribe to a SensorRelay on another host (subscribe()), which then
+// sends it the samples of its own sensors.
+class SensorReceiver : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SensorReceiver(SensorTable *table, QObject *parent = nullptr);
+    ~SensorReceiver();
+    bool bind(quint16 port, bool shared = false);
+    bool listenLocal(const QString &path);
+    bool joinMulticast(const QString &group, const QString &interfaceName);
+    // Must be called after bind(). The subscription is renewed while the
+    // receiver runs and cancelled when it is destroyed.
+    bool subscribe(const QString &host, quint16 port);
+    // Must be called before bind().
+    void setBusyPoll(bool enabled);
+    // cpu -1 leaves the thread unpinned, realtimePriority 0 leaves it in
+    // the normal scheduling class.
+    void setThreadOptions(int cpu, int realtimePriority);
+    // Must be called before the receiver is moved to its thread.
+    void setFilters(const QVector<OrientationFilter::Stage> &stages);
+    // Must be called before the receiver is moved to its thread. An empty
+    // allow-list allows any source, a rate of 0 does not limit it.
+    void setAdmission(const QVector<AdmissionControl::Subnet> &allowed, int rate);
+    // May be called from any thread.
+    ReceiverStatistics statistics() const;
+    // Kernel receive timestamp to handling, for datagrams that have one.
+    const LatencyHistogram &ingestLatency() const;
+
+public slots:
+    // Connect to the started() signal of the receiver's thread. Returns
+    // only when busy polling, once the thread is asked to interrupt.
+    void run();
+
+private slots:
+    void onReadPendingDatagrams();
+
+private:
+#ifdef Q_OS_LINUX
+    void onSocketActivated();
+    void poll();
+    void onLocalConnection();
+    void onLocalActivated(int fd);
+    bool isRelay(const sockaddr *address) const;
+    bool drain(int fd, bool connected);
+    void sendReply(int fd, bool connected, int i, const char *reply, int size);
+#endif
+    bool bindFallback(quint16 port, bool shared);
+    void sendSubscription(SensorProtocol::PacketType type);
+    bool isChallenge(const char *packet, int size) const;
+    void takeChallenge(const char *packet);
+
+    QUdpSocket *m_socket;
+    QTimer *m_subscriptionTimer;
+    QHostAddress m_relayAddress;
+    quint16 m_relayPort;
+    // The cookie the relay last challenged with, sent in every request.
+    quint64 m_relayCookie;
+#ifdef Q_OS_LINUX
+    int m_fd;
+    QSocketNotifier *m_notifier;
+    DatagramBatch *m_batch;
+    sockaddr_storage m_relaySocketAddress;
+    socklen_t m_relaySocketAddressLength;
+
+    struct LocalConnection
+    {
+        int fd;
+        QSocketNotifier *notifier;
+    };
+    enum { MaxLocalConnections = 64 };
+    QString m_localPath;
+    int m_localFd;
+    QSocketNotifier *m_localNotifier;
+    QVector<LocalConnection> m_localConnections;
+#endif
+    bool m_busyPoll;
+    int m_cpu;
+    int m_realtimePriority;
+    LatencyHistogram m_ingestLatency;
+    AdmissionControl m_admission;
+    PacketHandler m_handler;
+};
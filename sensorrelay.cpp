@@ -0,0 +1,349 @@
+#include "sensorrelay.h"
+#include "hotlog.h"
+#include "sensorclock.h"
+
+#include <QDebug>
+#include <QRandomGenerator>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+
+// Longest wait for a subscription request between two ticks, which bounds
+// how long stop() can go unnoticed, in nanoseconds.
+static const qint64 MaximumWait = 100000000;
+
+
+static inline quint64
+rotate(quint64 x, int bits) {
+    return (x << bits) | (x >> (64 - bits));
+}
+
+
+// SipHash-2-4 of the words of a message, a keyed hash that cannot be
+// forged without the key.
+static quint64
+sipHash(const quint64 *key, const quint64 *words, int count) {
+    quint64 v0 = key[0] ^ 0x736f6d6570736575ULL;
+    quint64 v1 = key[1] ^ 0x646f72616e646f6dULL;
+    quint64 v2 = key[0] ^ 0x6c7967656e657261ULL;
+    quint64 v3 = key[1] ^ 0x7465646279746573ULL;
+    auto round = [&]() {
+        v0 += v1; v1 = rotate(v1, 13); v1 ^= v0; v0 = rotate(v0, 32);
+        v2 += v3; v3 = rotate(v3, 16); v3 ^= v2;
+        v0 += v3; v3 = rotate(v3, 21); v3 ^= v0;
+        v2 += v1; v1 = rotate(v1, 17); v1 ^= v2; v2 = rotate(v2, 32);
+    };
+    for (int i = 0; i <= count; ++i) {
+        // The last word holds the length in bytes.
+        const quint64 m = i < count ? words[i] : quint64(count * 8) << 56;
+        v3 ^= m;
+        round();
+        round();
+        v0 ^= m;
+    }
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; ++i)
+        round();
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+
+//============================================================================//
+//                                SensorRelay                                 //
+//============================================================================//
+
+SensorRelay::SensorRelay(const SensorTable *table, QObject *parent)
+    : QThread(parent)
+#ifdef Q_OS_LINUX
+    , m_fd(-1)
+    , m_batch(new DatagramBatch)
+    , m_subscriberCount(0)
+#endif
+    , m_table(table)
+    , m_period(1000000000 / 60)
+{
+    m_key[0] = QRandomGenerator::system()->generate64();
+    m_key[1] = QRandomGenerator::system()->generate64();
+    setObjectName(QStringLiteral("Sensor relay"));
+#ifdef Q_OS_LINUX
+    memset(m_forwarded, 0, sizeof(m_forwarded));
+    memset(m_messages, 0, sizeof(m_messages));
+    for (int i = 0; i < MaxPackets; ++i)
+        m_iovecs[i].iov_base = m_packets[i];
+#endif
+}
+
+
+SensorRelay::~SensorRelay() {
+    stop();
+    wait();
+#ifdef Q_OS_LINUX
+    if (m_fd >= 0)
+        close(m_fd);
+    delete m_batch;
+#endif
+}
+
+
+bool
+SensorRelay::bind(quint16 port) {
+#ifdef Q_OS_LINUX
+    m_fd = DatagramBatch::openSocket(port, false);
+    if (m_fd < 0) {
+        qWarning() << "Unable to bind the relay to port" << port << ":" << strerror(errno);
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(port);
+    qWarning() << "The sensor relay is only available on Linux";
+    return false;
+#endif
+}
+
+
+void
+SensorRelay::setRate(int rate) {
+    m_period = 1000000000 / qBound(1, rate, 1000);
+}
+
+
+void
+SensorRelay::setAdmission(const QVector<AdmissionControl::Subnet> &allowed, int rate) {
+    m_admission.setAllowedSources(allowed);
+    m_admission.setRate(rate);
+}
+
+
+void
+SensorRelay::stop() {
+    requestInterruption();
+}
+
+
+RelayStatistics
+SensorRelay::statistics() const {
+    RelayStatistics statistics;
+    statistics.ticks = m_ticks.value();
+    statistics.samples = m_samples.value();
+    statistics.datagrams = m_datagrams.value();
+    statistics.dropped = m_dropped.value();
+    statistics.subscribers = m_activeSubscribers.value();
+    statistics.challenges = m_challenges.value();
+    ReceiverStatistics admission;
+    m_admission.addStatistics(&admission);
+    statistics.refused = admission.refused + admission.rateLimited;
+    return statistics;
+}
+
+
+void
+SensorRelay::run() {
+#ifdef Q_OS_LINUX
+    qint64 next = SensorClock::now();
+    while (!isInterruptionRequested()) {
+        const qint64 now = SensorClock::now();
+        if (now >= next) {
+            expireSubscribers(now);
+            // After a partial send, some subscribers may have missed the
+            // last update of a stream that has not changed since.
+            if (m_subscriberCount > 0 && !send(buildPackets())) {
+                for (Forwarded &forwarded : m_forwarded)
+                    forwarded.arrivalTime = 0;
+            }
+            m_ticks.add();
+            // Ticks missed are not made up for with a burst.
+            next += m_period;
+            if (next <= now)
+                next = now + m_period;
+        }
+        const qint64 wait = qBound(qint64(0), next - SensorClock::now(), MaximumWait);
+        const timespec timeout = { time_t(wait / 1000000000), long(wait % 1000000000) };
+        pollfd descriptor = { m_fd, POLLIN, 0 };
+        if (ppoll(&descriptor, 1, &timeout, nullptr) > 0)
+            receiveRequests();
+    }
+#endif
+}
+
+
+#ifdef Q_OS_LINUX
+void
+SensorRelay::receiveRequests() {
+    const qint64 now = SensorClock::now();
+    int n;
+    do {
+        n = m_batch->receive(m_fd);
+        for (int i = 0; i < n; ++i) {
+            const sockaddr *address = m_batch->address(i);
+            if (!m_admission.admit(address, now)
+                    || m_batch->size(i) != SensorProtocol::SubscriptionSize)
+                continue;
+            // Anything else sent to the relay is ignored.
+            const int type = SensorProtocol::packetType(m_batch->data(i), m_batch->size(i));
+            if (type != SensorProtocol::Subscribe && type != SensorProtocol::Unsubscribe)
+                continue;
+            // The cookie of the previous period is still good, so that
+            // one issued just before a period ends is.
+            const qint64 period = now / CookieLifetime;
+            const quint64 received = SensorProtocol::subscriptionCookie(m_batch->data(i));
+            const quint64 expected = cookie(address, period);
+            if (received != expected && received != cookie(address, period - 1))
+                challenge(address, m_batch->addressLength(i), expected);
+            else
+                subscribe(address, m_batch->addressLength(i),
+                          type == SensorProtocol::Subscribe, now);
+        }
+    } while (n == DatagramBatch::Capacity);
+}
+
+
+// The cookie of address, its host and port, for period.
+quint64
+SensorRelay::cookie(const sockaddr *address, qint64 period) const {
+    quint64 words[4] = { 0, 0, 0, quint64(period) };
+    char *message = reinterpret_cast<char *>(words);
+    if (address->sa_family == AF_INET6) {
+        const sockaddr_in6 *ipv6 = reinterpret_cast<const sockaddr_in6 *>(address);
+        memcpy(message, &ipv6->sin6_addr, 16);
+        memcpy(message + 16, &ipv6->sin6_port, 2);
+    } else if (address->sa_family == AF_INET) {
+        const sockaddr_in *ipv4 = reinterpret_cast<const sockaddr_in *>(address);
+        memcpy(message, &ipv4->sin_addr, 4);
+        memcpy(message + 16, &ipv4->sin_port, 2);
+    }
+    memcpy(message + 18, &address->sa_family, sizeof(address->sa_family));
+    return sipHash(m_key, words, 4);
+}
+
+
+// Tells address the cookie to send its requests with. The challenge is
+// the size of the request, so it never amplifies a forged one.
+void
+SensorRelay::challenge(const sockaddr *address, socklen_t length, quint64 cookie) {
+    char packet[SensorProtocol::SubscriptionSize];
+    SensorProtocol::writeSubscription(packet, SensorProtocol::Challenge, cookie);
+    if (sendto(m_fd, packet, sizeof(packet), MSG_DONTWAIT, address, length) == sizeof(packet))
+        m_challenges.add();
+}
+
+
+void
+SensorRelay::subscribe(const sockaddr *address, socklen_t length, bool subscribed, qint64 now) {
+    int i = 0;
+    while (i < m_subscriberCount
+           && (m_subscribers[i].addressLength != length
+               || memcmp(&m_subscribers[i].address, address, length) != 0))
+        ++i;
+    if (!subscribed) {
+        if (i < m_subscriberCount)
+            m_subscribers[i] = m_subscribers[--m_subscriberCount];
+    } else if (i < m_subscriberCount) {
+        m_subscribers[i].lastRequest = now;
+    } else if (m_subscriberCount == MaxSubscribers) {
+        HotLog::log(HotLog::TooManySubscribers);
+    } else {
+        Subscriber &subscriber = m_subscribers[m_subscriberCount++];
+        memcpy(&subscriber.address, address, length);
+        subscriber.addressLength = length;
+        subscriber.lastRequest = now;
+        // Send every stream again, so that the new subscriber also gets
+        // those that stand still.
+        for (Forwarded &forwarded : m_forwarded)
+            forwarded.arrivalTime = 0;
+    }
+    m_activeSubscribers.set(quint64(m_subscriberCount));
+}
+
+
+void
+SensorRelay::expireSubscribers(qint64 now) {
+    for (int i = 0; i < m_subscriberCount; ) {
+        if (now - m_subscribers[i].lastRequest > SubscriptionTimeout)
+            m_subscribers[i] = m_subscribers[--m_subscriberCount];
+        else
+            ++i;
+    }
+    m_activeSubscribers.set(quint64(m_subscriberCount));
+}
+
+
+// Writes the newest sample of every stream that changed since the last
+// tick into as few packets as possible; returns how many.
+int
+SensorRelay::buildPackets() {
+    using namespace SensorProtocol;
+    int packets = 0;
+    int records = 0;
+    const int streams = m_table->streamCount();
+    for (int id = 0; id < streams; ++id) {
+        SensorSample sample;
+        Forwarded &forwarded = m_forwarded[id];
+        if (!m_table->history(id).latest(&sample)
+                || (sample.arrivalTime == forwarded.arrivalTime
+                    && sample.sequence == forwarded.sourceSequence))
+            continue;
+        forwarded.arrivalTime = sample.arrivalTime;
+        forwarded.sourceSequence = sample.sequence;
+        if (records == 0) {
+            writeHeader(m_packets[packets], OrientationBatch, 0, SmallestThree48);
+            ++packets;
+        }
+        writeRecord(m_packets[packets - 1] + HeaderSize + records * RecordSize,
+                    sample, ++forwarded.sequence);
+        m_sizes[packets - 1] = HeaderSize + ++records * RecordSize;
+        if (records == MaxSamples)
+            records = 0;
+    }
+    return packets;
+}
+
+
+// Sends every packet to every subscriber, in one call unless a send fails.
+// Returns false if any was dropped.
+bool
+SensorRelay::send(int packets) {
+    if (packets == 0)
+        return true;
+    int n = 0;
+    for (int p = 0; p < packets; ++p)
+        m_iovecs[p].iov_len = size_t(m_sizes[p]);
+    for (int s = 0; s < m_subscriberCount; ++s) {
+        for (int p = 0; p < packets; ++p, ++n) {
+            msghdr &header = m_messages[n].msg_hdr;
+            header.msg_name = &m_subscribers[s].address;
+            header.msg_namelen = m_subscribers[s].addressLength;
+            header.msg_iov = &m_iovecs[p];
+            header.msg_iovlen = 1;
+        }
+    }
+    for (int p = 0; p < packets; ++p)
+        m_samples.add(quint64((m_sizes[p] - SensorProtocol::HeaderSize) / RecordSize));
+    bool complete = true;
+    for (int sent = 0; sent < n; ) {
+        const int result = sendmmsg(m_fd, m_messages + sent, unsigned(n - sent), MSG_DONTWAIT);
+        if (result > 0) {
+            sent += result;
+            m_datagrams.add(quint64(result));
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+            // The socket buffer is full; the next tick sends them again.
+            m_dropped.add(quint64(n - sent));
+            complete = false;
+            break;
+        } else if (errno != EINTR) {
+            // Only this datagram failed, say to an unreachable
+            // subscriber; carry on with the others.
+            m_dropped.add();
+            complete = false;
+            ++sent;
+        }
+    }
+    return complete;
+}
+#endif
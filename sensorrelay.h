@@ -0,0 +1,115 @@
+#pragma once
+
+#include "admissioncontrol.h"
+#include "datagrambatch.h"
+#include "sensorprotocol.h"
+#include "sensorstatistics.h"
+#include "sensortable.h"
+
+#include <QThread>
+
+
+// Forwards the samples of a SensorTable to viewers on other hosts, which
+// then draw the same session from orientations alone.
+//
+// Viewers subscribe by sending Subscribe requests (see SensorProtocol) to
+// the relay's UDP port. Requests go through an AdmissionControl first, and
+// must carry the cookie the relay issues to their address in a Challenge,
+// so that a request with a forged source address cannot have the samples
+// sent to someone who did not ask for them. Cookies are keyed hashes of
+// the address and the current CookieLifetime period, so the relay keeps
+// no state for addresses it has only challenged.
+//
+// Every tick the relay takes the newest sample of each stream that has
+// changed since the last tick, so however fast the sensors send, each
+// subscriber gets at most one update per stream and tick. The updates go
+// out as SmallestThree48 OrientationBatch packets, the same for every
+// subscriber, all of them in one sendmmsg() call. Nothing is allocated and
+// the socket never blocks: what does not fit in its buffer is dropped, and
+// the next tick sends every stream again, so that those that stand still
+// are not left out of date.
+//
+// Runs on its own thread and only reads the table, so ingest and render
+// never wait for it. Only available on Linux.
+class SensorRelay : public QThread
+{
+    Q_OBJECT
+public:
+    enum {
+        MaxSubscribers = 64,
+        RecordSize = SensorProtocol::RecordHeaderSize + 6,
+        MaxPackets = (SensorTable::Capacity + SensorProtocol::MaxSamples - 1)
+                     / SensorProtocol::MaxSamples,
+        PacketSize = SensorProtocol::HeaderSize + SensorProtocol::MaxSamples * RecordSize
+    };
+    // Subscribers that have not renewed their subscription for this long,
+    // in nanoseconds, are dropped.
+    static const qint64 SubscriptionTimeout = 5000000000;
+    // How long a cookie is good for, at least, in nanoseconds.
+    static const qint64 CookieLifetime = 60000000000;
+
+    SensorRelay(const SensorTable *table, QObject *parent = nullptr);
+    ~SensorRelay();
+
+    bool bind(quint16 port);
+    // Updates per second; must be called before the thread is started.
+    void setRate(int rate);
+    // Sources that may send requests, all if empty, and how many requests
+    // per second each may send; must be called before the thread is
+    // started.
+    void setAdmission(const QVector<AdmissionControl::Subnet> &allowed, int rate);
+    void stop();
+    // May be called from any thread.
+    RelayStatistics statistics() const;
+
+protected:
+    void run() override;
+
+private:
+#ifdef Q_OS_LINUX
+    struct Subscriber
+    {
+        sockaddr_storage address;
+        socklen_t addressLength;
+        qint64 lastRequest;
+    };
+
+    void receiveRequests();
+    quint64 cookie(const sockaddr *address, qint64 period) const;
+    void challenge(const sockaddr *address, socklen_t length, quint64 cookie);
+    void subscribe(const sockaddr *address, socklen_t length, bool subscribed, qint64 now);
+    void expireSubscribers(qint64 now);
+    int buildPackets();
+    bool send(int packets);
+
+    int m_fd;
+    DatagramBatch *m_batch;
+    Subscriber m_subscribers[MaxSubscribers];
+    int m_subscriberCount;
+    // Per stream: the last sample forwarded, told apart from the others
+    // by its arrival time and sequence number, and the sequence number
+    // it was forwarded with.
+    struct Forwarded
+    {
+        qint64 arrivalTime;
+        quint32 sourceSequence;
+        quint32 sequence;
+    };
+    Forwarded m_forwarded[SensorTable::Capacity];
+    int m_sizes[MaxPackets];
+    iovec m_iovecs[MaxPackets];
+    mmsghdr m_messages[MaxSubscribers * MaxPackets];
+    alignas(64) char m_packets[MaxPackets][PacketSize];
+#endif
+    const SensorTable *m_table;
+    qint64 m_period;
+    // Key of the cookies, new every run.
+    quint64 m_key[2];
+    AdmissionControl m_admission;
+    StatisticsCounter m_challenges;
+    StatisticsCounter m_ticks;
+    StatisticsCounter m_samples;
+    StatisticsCounter m_datagrams;
+    StatisticsCounter m_dropped;
+    StatisticsCounter m_activeSubscribers;
+};
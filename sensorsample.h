@@ -0,0 +1,42 @@
+#pragma once
+
+#include "quaternionmath.h"
+
+#include <QtGlobal>
+
+
+// One complete orientation as delivered by a sensor (w, x, y, z).
+//
+// Times are in SensorClock nanoseconds unless noted: arrivalTime is when the
+// datagram reached us, sampleTime our best estimate of when the sensor took
+// the sample, which is what interpolation works with. senderTime is the
+// sender's own timestamp, on the sender's clock, for packets that carry one.
+// The sequence number is only meaningful for packets that carry one. The
+// angular velocity (world frame, radians per second) is estimated on ingest.
+// Samples flagged fused were sent as raw IMU readings and their orientation
+// is fused on ingest. Samples flagged synchronized have their sampleTime
+// mapped from senderTime through the sender's synchronized clock (see
+// ClockSync), rather than estimated from arrival.
+struct SensorSample
+{
+    qint64 arrivalTime = 0;
+    qint64 sampleTime = 0;
+    qint64 senderTime = 0;
+    quint32 sequence = 0;
+    quint16 sensorId = 0;
+    bool sequenced = false;
+    bool senderTimed = false;
+    bool fused = false;
+    bool synchronized = false;
+    float w = 1.0f;
+    float x = 0.0f;
+    float y = 0.0f;
+    float z = 0.0f;
+    float vx = 0.0f;
+    float vy = 0.0f;
+    float vz = 0.0f;
+
+    QuaternionMath::Quaternion orientation() const {
+        return { w, x, y, z };
+    }
+};
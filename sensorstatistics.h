@@ -0,0 +1,94 @@
+#pragma once
+
+#include <QtGlobal>
+
+#include <atomic>
+
+
+// Counter bumped by a single thread and read by any other.
+class StatisticsCounter
+{
+public:
+    void add(quint64 n = 1) {
+        m_value.store(m_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    void set(quint64 value) {
+        m_value.store(value, std::memory_order_relaxed);
+    }
+    quint64 value() const {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<quint64> m_value{0};
+};
+
+
+// Counters of one sensor stream, from sequence numbers of versioned
+// packets. Unversioned packets only count as received.
+struct StreamStatistics
+{
+    quint64 received = 0;   // samples accepted
+    quint64 lost = 0;       // sequence numbers skipped
+    quint64 stale = 0;      // samples older than, or duplicates of, one already accepted
+    quint64 restarts = 0;   // sequence jumped far back, taken as a sender restart
+};
+
+
+// Counters of one receiving socket.
+struct ReceiverStatistics
+{
+    quint64 datagrams = 0;
+    quint64 malformed = 0;           // wrong size, magic or packet type, or truncated
+    quint64 unsupportedVersion = 0;
+    quint64 unknownSensor = 0;       // sensor ID beyond SensorTable::Capacity
+    quint64 kernelDrops = 0;         // dropped by the kernel for lack of buffer space (SO_RXQ_OVFL)
+    quint64 foreign = 0;             // samples of a stream another ingest thread is feeding
+    quint64 refused = 0;             // from sources outside the allow-list
+    quint64 rateLimited = 0;         // over their source's rate
+
+    ReceiverStatistics &operator+=(const ReceiverStatistics &other) {
+        datagrams += other.datagrams;
+        malformed += other.malformed;
+        unsupportedVersion += other.unsupportedVersion;
+        unknownSensor += other.unknownSensor;
+        kernelDrops += other.kernelDrops;
+        foreign += other.foreign;
+        refused += other.refused;
+        rateLimited += other.rateLimited;
+        return *this;
+    }
+};
+
+
+// Counters of a SensorRelay.
+struct RelayStatistics
+{
+    quint64 ticks = 0;
+    quint64 samples = 0;             // stream updates forwarded, once per tick at most
+    quint64 datagrams = 0;           // sent, counting each subscriber
+    quint64 dropped = 0;             // not sent, the socket buffer being full or the send failing
+    quint64 subscribers = 0;         // current
+    quint64 challenges = 0;          // requests answered with a Challenge, their cookie being wrong
+    quint64 refused = 0;             // requests from sources not allowed, or over their rate
+};
+
+
+// Counters of a SampleRecorder.
+struct RecorderStatistics
+{
+    quint64 recorded = 0;            // samples written
+    quint64 lost = 0;                // overrun on the SampleBus before they could be written
+    quint64 writeErrors = 0;         // writes the file did not take, which end the recording
+};
+
+
+// Counters of a StreamAligner.
+struct AlignerStatistics
+{
+    quint64 frames = 0;
+    quint64 skipped = 0;             // frame times passed over, the thread having fallen behind
+    quint64 late = 0;                // samples older than a frame already made
+    quint64 truncated = 0;           // streams held at their oldest sample, their history too short
+    quint64 lost = 0;                // overrun on the SampleBus before they could be read
+};
@@ -0,0 +1,186 @@
+#include "sensortable.h"
+#include "sensorclock.h"
+
+
+//============================================================================//
+//                                 SensorTable                                //
+//============================================================================//
+
+SensorTable::SensorTable()
+    : m_streams(new Stream[Capacity])
+    , m_streamCount(0)
+    , m_writerCount(0)
+    , m_referenceCount(0)
+{
+}
+
+
+SensorTable::~SensorTable() {
+    delete[] m_streams;
+}
+
+
+int
+SensorTable::registerWriter() {
+    // Owner 0 means the stream has none.
+    return m_writerCount.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+
+SensorTable::Result
+SensorTable::admit(const SensorSample &sample, int writer) {
+    const int id = sample.sensorId;
+    if (id >= Capacity)
+        return UnknownSensor;
+    Stream &stream = m_streams[id];
+    int owner = stream.owner.load(std::memory_order_relaxed);
+    if (owner != (writer | Busy)) {
+        // Claimed by another writer.
+        if (owner & Busy)
+            return Foreign;
+        // Acquiring lastArrival makes the previous owner's updates of the
+        // stream visible before this writer continues from them.
+        if (owner != writer && owner != 0
+                && sample.arrivalTime - stream.lastArrival.load(std::memory_order_acquire)
+                   < HandoverTime)
+            return Foreign;
+        // Fails if another writer claimed the stream in the meantime, the
+        // owner resuming just as it is taken over, say.
+        if (!stream.owner.compare_exchange_strong(owner, writer | Busy,
+                                                  std::memory_order_acq_rel))
+            return Foreign;
+    }
+    if (!checkSequence(stream, sample))
+        return Stale;
+    stream.received.add();
+    return Accepted;
+}
+
+
+void
+SensorTable::publish(SensorSample *sample) {
+    const int id = sample->sensorId;
+    Stream &stream = m_streams[id];
+    stream.velocity.update(sample);
+    stream.history.push(*sample);
+    stream.lastArrival.store(sample->arrivalTime, std::memory_order_release);
+    int count = m_streamCount.load(std::memory_order_relaxed);
+    while (id >= count && !m_streamCount.compare_exchange_weak(count, id + 1, std::memory_order_release))
+        ;
+}
+
+
+void
+SensorTable::release(int sensorId, int writer) {
+    if (sensorId < 0 || sensorId >= Capacity)
+        return;
+    int claimed = writer | Busy;
+    // Releasing makes this writer's updates of the stream visible to the
+    // next one to claim it.
+    m_streams[sensorId].owner.compare_exchange_strong(claimed, writer, std::memory_order_release,
+                                                      std::memory_order_relaxed);
+}
+
+
+// Counts gaps and tells whether sample is newer than the last one accepted.
+bool
+SensorTable::checkSequence(Stream &stream, const SensorSample &sample) {
+    if (!sample.sequenced)
+        return true;
+    if (stream.sequenced) {
+        const qint32 step = qint32(sample.sequence - stream.lastSequence);
+        if (step < -RestartWindow) {
+            stream.restarts.add();
+        } else if (step <= 0) {
+            stream.stale.add();
+            return false;
+        } else if (step > 1) {
+            stream.lost.add(step - 1);
+        }
+    }
+    stream.lastSequence = sample.sequence;
+    stream.sequenced = true;
+    return true;
+}
+
+
+StreamStatistics
+SensorTable::statistics(int sensorId) const {
+    StreamStatistics result;
+    if (sensorId < 0 || sensorId >= Capacity)
+        return result;
+    const Stream &stream = m_streams[sensorId];
+    result.received = stream.received.value();
+    result.lost = stream.lost.value();
+    result.stale = stream.stale.value();
+    result.restarts = stream.restarts.value();
+    return result;
+}
+
+
+bool
+SensorTable::isLive(int sensorId) const {
+    SensorSample sample;
+    return sensorId < streamCount() && m_streams[sensorId].history.latest(&sample);
+}
+
+
+void
+SensorTable::setCalibration(int sensorId, const Calibration &calibration) {
+    if (sensorId < 0 || sensorId >= Capacity)
+        return;
+    QMutexLocker locker(&m_calibrationMutex);
+    m_streams[sensorId].calibration.store(calibration);
+}
+
+
+Calibration
+SensorTable::calibration(int sensorId) const {
+    Calibration calibration;
+    if (sensorId < 0 || sensorId >= Capacity)
+        return calibration;
+    // Writers are rare and quick.
+    while (!m_streams[sensorId].calibration.load(&calibration))
+        ;
+    return calibration;
+}
+
+
+void
+SensorTable::requestTare(int sensorId) {
+    if (sensorId >= 0 && sensorId < Capacity)
+        m_streams[sensorId].tareRequested.store(SensorClock::now(), std::memory_order_relaxed);
+}
+
+
+bool
+SensorTable::loadCalibration(int sensorId, Calibration *calibration) const {
+    return m_streams[sensorId].calibration.load(calibration);
+}
+
+
+// Cheap when there is no request, which is nearly always. A request the
+// sensor did not answer in time lapses, so that one made while it was
+// away does not turn whatever pose it comes back in into its zero.
+bool
+SensorTable::takeTareRequest(int sensorId, qint64 arrivalTime) {
+    std::atomic<qint64> &request = m_streams[sensorId].tareRequested;
+    if (request.load(std::memory_order_relaxed) == 0)
+        return false;
+    const qint64 requested = request.exchange(0, std::memory_order_relaxed);
+    return requested != 0 && arrivalTime - requested < TareTimeout;
+}
+
+
+// Makes orientation, before calibration, the stream's zero pose.
+void
+SensorTable::captureReference(int sensorId, const QuaternionMath::Quaternion &orientation) {
+    QMutexLocker locker(&m_calibrationMutex);
+    Calibration calibration;
+    while (!m_streams[sensorId].calibration.load(&calibration))
+        ;
+    calibration.reference = QuaternionMath::normalized(
+                QuaternionMath::multiply(orientation, calibration.mounting));
+    m_streams[sensorId].calibration.store(calibration);
+    m_referenceCount.fetch_add(1, std::memory_order_release);
+}
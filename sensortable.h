@@ -0,0 +1,137 @@
+#pragma once
+
+#include "calibration.h"
+#include "jitterbuffer.h"
+#include "samplebus.h"
+#include "sensorsample.h"
+#include "sensorstatistics.h"
+#include "seqlock.h"
+#include "velocityestimator.h"
+
+#include <QMutex>
+
+#include <atomic>
+
+
+// Per-stream state of every sensor, indexed by sensor ID.
+//
+// Ingest threads admit() samples, then publish() the ones accepted, once
+// they have been filtered and calibrated, then release() the streams they
+// admitted samples of. Each stream is owned by the writer that last fed
+// it, so that its state only ever has one writer: admit() claims the
+// stream for its owner until release(), and samples from other writers
+// are turned away as Foreign while it is claimed, or until the owner has
+// been quiet for HandoverTime, when the next writer to claim the stream
+// takes it over. The table is thus shared by any number of ingest
+// threads, each updating the disjoint set of streams it receives, without
+// a lock. Samples with
+// sequence numbers that are not newer than the last accepted one are
+// discarded. The render thread reads the streams' histories, and anyone
+// their statistics, without locking.
+//
+// Each stream also has a Calibration, which the ingest path applies (see
+// Calibrator) before publishing. It may be changed from any thread; the
+// rare writers take a lock, readers never do.
+//
+// The streams only keep a short history; consumers that need every
+// sample read them from the table's SampleBus instead.
+class SensorTable
+{
+public:
+    enum {
+        Capacity = 256,
+        // A sequence number this far behind the last one means the sender
+        // restarted rather than that the packet was reordered.
+        RestartWindow = 1024
+    };
+    // How long a stream's owner must have been quiet, in nanoseconds of
+    // arrival time, before another writer may take the stream over.
+    static const qint64 HandoverTime = 1000000000;
+    // How long a tare request waits for a sample, in nanoseconds of
+    // arrival time, before it lapses.
+    static const qint64 TareTimeout = 2000000000;
+
+    enum Result {
+        Accepted,
+        Stale,
+        UnknownSensor,
+        Foreign
+    };
+
+    SensorTable();
+    ~SensorTable();
+    SensorTable(const SensorTable &) = delete;
+    SensorTable &operator=(const SensorTable &) = delete;
+
+    // A new writer ID for an ingest thread to admit() samples with.
+    int registerWriter();
+    // Whether sample is to be published: its stream must be writer's, or
+    // free to take over, and its sequence number newer than the last one
+    // accepted. Accepted samples count as received. Unless it returns
+    // UnknownSensor or Foreign, the stream stays claimed by writer until
+    // it calls release().
+    Result admit(const SensorSample &sample, int writer);
+    // Fills in the derived fields of an accepted sample and makes it
+    // visible to readers. Samples must be published by the writer that
+    // admitted them, in the order they were admitted, before it releases
+    // their stream.
+    void publish(SensorSample *sample);
+    // Ends writer's claim on the stream; does nothing if it has none.
+    void release(int sensorId, int writer);
+
+    // One past the highest sensor ID seen so far.
+    int streamCount() const { return m_streamCount.load(std::memory_order_acquire); }
+    bool isLive(int sensorId) const;
+    const JitterBuffer &history(int sensorId) const { return m_streams[sensorId].history; }
+    StreamStatistics statistics(int sensorId) const;
+    SampleBus &bus() { return m_bus; }
+
+    void setCalibration(int sensorId, const Calibration &calibration);
+    Calibration calibration(int sensorId) const;
+    // Has the ingest path take the next sample of the stream to arrive
+    // within TareTimeout as its reference pose.
+    void requestTare(int sensorId);
+    // Bumped every time a reference pose is captured, so that the GUI can
+    // tell when to save the calibrations.
+    quint32 referenceCount() const { return m_referenceCount.load(std::memory_order_acquire); }
+
+    // For the ingest path. loadCalibration() fails if a writer is busy.
+    bool loadCalibration(int sensorId, Calibration *calibration) const;
+    quint32 calibrationSequence(int sensorId) const {
+        return m_streams[sensorId].calibration.sequence();
+    }
+    // Whether a sample that arrived at arrivalTime is to be the stream's
+    // reference pose; the request is taken either way.
+    bool takeTareRequest(int sensorId, qint64 arrivalTime);
+    void captureReference(int sensorId, const QuaternionMath::Quaternion &orientation);
+
+private:
+    // Set in a stream's owner while the owner is claiming it.
+    static const int Busy = 0x40000000;
+
+    struct Stream
+    {
+        std::atomic<int> owner{0};
+        std::atomic<qint64> lastArrival{0};
+        quint32 lastSequence = 0;
+        bool sequenced = false;
+        StatisticsCounter received;
+        StatisticsCounter lost;
+        StatisticsCounter stale;
+        StatisticsCounter restarts;
+        VelocityEstimator velocity;
+        JitterBuffer history;
+        SeqLock<Calibration> calibration;
+        // SensorClock time of the pending tare request, 0 for none.
+        std::atomic<qint64> tareRequested{0};
+    };
+
+    bool checkSequence(Stream &stream, const SensorSample &sample);
+
+    Stream *m_streams;
+    std::atomic<int> m_streamCount;
+    std::atomic<int> m_writerCount;
+    std::atomic<quint32> m_referenceCount;
+    QMutex m_calibrationMutex;
+    SampleBus m_bus;
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <QtGlobal>
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+
+// Single writer slot holding the most recent value of T.
+// Neither side ever waits: store() always completes in a fixed number of
+// steps and a load() that overlaps a store() returns false, in which case
+// the reader simply keeps the copy it already has.
+template <typename T>
+class SeqLock
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "SeqLock requires a trivially copyable type");
+
+public:
+    SeqLock() {
+        store(T());
+    }
+
+    void store(const T &value) {
+        quint64 words[WordCount] = {};
+        memcpy(words, &value, sizeof(T));
+        const quint32 sequence = m_sequence.load(std::memory_order_relaxed);
+        m_sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (int i = 0; i < WordCount; ++i)
+            m_words[i].store(words[i], std::memory_order_relaxed);
+        m_sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    bool load(T *value) const {
+        const quint32 before = m_sequence.load(std::memory_order_acquire);
+        if (before & 1)
+            return false;
+        quint64 words[WordCount];
+        for (int i = 0; i < WordCount; ++i)
+            words[i] = m_words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_sequence.load(std::memory_order_relaxed) != before)
+            return false;
+        memcpy(value, words, sizeof(T));
+        return true;
+    }
+
+    // Even values only; bumped by two on every store().
+    quint32 sequence() const {
+        return m_sequence.load(std::memory_order_acquire) & ~quint32(1);
+    }
+
+private:
+    enum { WordCount = (sizeof(T) + sizeof(quint64) - 1) / sizeof(quint64) };
+
+    alignas(64) std::atomic<quint32> m_sequence{0};
+    std::atomic<quint64> m_words[WordCount];
+};
@@ -0,0 +1,93 @@
+#include "serialframer.h"
+
+#include <QtEndian>
+
+
+//============================================================================//
+//                                SerialFramer                                //
+//============================================================================//
+
+SerialFramer::SerialFramer()
+    : m_length(0)
+    , m_remaining(0)
+    , m_zeroPending(false)
+    , m_discarding(true)
+{
+}
+
+
+void
+SerialFramer::feed(const char *data, int size, PacketHandler *handler, qint64 arrivalTime) {
+    for (int i = 0; i < size; ++i) {
+        const quint8 byte = quint8(data[i]);
+        if (byte == 0) {
+            endFrame(handler, arrivalTime);
+            continue;
+        }
+        if (m_discarding)
+            continue;
+        if (m_remaining == 0) {
+            // A block code: the number of data bytes that follow, plus one.
+            // Every block but a full one is followed by a zero, unless it
+            // is the last.
+            const bool zero = m_zeroPending;
+            m_remaining = byte - 1;
+            m_zeroPending = byte != 0xff;
+            if (zero)
+                append(0, handler);
+            continue;
+        }
+        append(char(byte), handler);
+        --m_remaining;
+    }
+}
+
+
+void
+SerialFramer::append(char byte, PacketHandler *handler) {
+    if (m_length == int(sizeof(m_frame))) {
+        handler->countCorrupt();
+        m_discarding = true;
+        return;
+    }
+    m_frame[m_length++] = byte;
+}
+
+
+// A delimiter: checks and hands over the frame it ends, if any, and starts
+// the next one.
+void
+SerialFramer::endFrame(PacketHandler *handler, qint64 arrivalTime) {
+    const bool discarding = m_discarding;
+    const int length = m_length;
+    const int remaining = m_remaining;
+    m_discarding = false;
+    m_length = 0;
+    m_remaining = 0;
+    m_zeroPending = false;
+    // Back to back delimiters are idle line, not empty frames.
+    if (discarding || length == 0)
+        return;
+    if (remaining != 0 || length < CrcSize + 1) {
+        handler->countCorrupt();
+        return;
+    }
+    const int size = length - CrcSize;
+    if (qFromLittleEndian<quint16>(m_frame + size) != crc16(m_frame, size)) {
+        handler->countCorrupt();
+        return;
+    }
+    handler->handle(m_frame, size, arrivalTime);
+}
+
+
+quint16
+SerialFramer::crc16(const char *data, int size) {
+    quint16 crc = 0xffff;
+    for (int i = 0; i < size; ++i) {
+        quint16 x = quint16((crc >> 8) ^ quint8(data[i]));
+        x ^= x >> 4;
+        crc = quint16((crc << 8) ^ (x << 12) ^ (x << 5) ^ x);
+    }
+    return crc;
+}
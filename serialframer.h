@@ -0,0 +1,50 @@
+#pragma once
+
+#include "packethandler.h"
+
+
+// Splits the byte stream of a serial link into native protocol packets.
+//
+// Each packet is followed by its CRC-16/CCITT-FALSE (polynomial 0x1021,
+// initial value 0xffff, little-endian), and the two are COBS encoded
+// (Consistent Overhead Byte Stuffing) and terminated by a zero byte:
+//
+//    COBS(packet, crc) 0x00
+//
+// COBS leaves no zero byte inside a frame, so the decoder resynchronizes
+// at the next delimiter after line noise, a dropped byte or joining the
+// stream half way through a frame. Senders should also send a delimiter
+// before their first frame, which is otherwise taken for the tail of one
+// that started before the port was opened. Frames are decoded as the bytes come
+// in, with no second pass and no allocation.
+class SerialFramer
+{
+public:
+    enum {
+        MaxPacketSize = 2048,
+        CrcSize = 2
+    };
+
+    SerialFramer();
+    SerialFramer(const SerialFramer &) = delete;
+    SerialFramer &operator=(const SerialFramer &) = delete;
+
+    // Hands every complete frame among the bytes to handler, which also
+    // counts the corrupt ones.
+    void feed(const char *data, int size, PacketHandler *handler, qint64 arrivalTime);
+
+    static quint16 crc16(const char *data, int size);
+
+private:
+    void append(char byte, PacketHandler *handler);
+    void endFrame(PacketHandler *handler, qint64 arrivalTime);
+
+    char m_frame[MaxPacketSize + CrcSize];
+    int m_length;
+    // Bytes left in the current COBS block, and whether a zero follows it
+    // if another block does.
+    int m_remaining;
+    bool m_zeroPending;
+    // Skipping to the next delimiter, at startup and after an overlong frame.
+    bool m_discarding;
+};
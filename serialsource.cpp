@@ -0,0 +1,167 @@
+#include "serialsource.h"
+#include "sensorclock.h"
+
+#include <QDebug>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/serial.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef Q_OS_LINUX
+static speed_t
+speedFor(int baudRate) {
+    switch (baudRate) {
+    case 9600:    return B9600;
+    case 19200:   return B19200;
+    case 38400:   return B38400;
+    case 57600:   return B57600;
+    case 115200:  return B115200;
+    case 230400:  return B230400;
+    case 460800:  return B460800;
+    case 500000:  return B500000;
+    case 576000:  return B576000;
+    case 921600:  return B921600;
+    case 1000000: return B1000000;
+    case 1500000: return B1500000;
+    case 2000000: return B2000000;
+    case 3000000: return B3000000;
+    case 4000000: return B4000000;
+    default:      return B0;
+    }
+}
+#endif
+
+
+//============================================================================//
+//                                SerialSource                                //
+//============================================================================//
+
+SerialSource::SerialSource(SensorTable *table, QObject *parent)
+    : QThread(parent)
+    , m_fd(-1)
+    , m_handler(table)
+{
+    setObjectName(QStringLiteral("Sensor serial port"));
+}
+
+
+SerialSource::~SerialSource() {
+    stop();
+    wait();
+#ifdef Q_OS_LINUX
+    if (m_fd >= 0)
+        ::close(m_fd);
+#endif
+}
+
+
+bool
+SerialSource::open(const QString &device, int baudRate) {
+#ifdef Q_OS_LINUX
+    m_device = device;
+    const speed_t speed = speedFor(baudRate);
+    if (speed == B0) {
+        qWarning() << "Unsupported serial baud rate" << baudRate;
+        return false;
+    }
+    const QByteArray path = device.toLocal8Bit();
+    m_fd = ::open(path.constData(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (m_fd < 0) {
+        qWarning() << "Unable to open" << device << ":" << strerror(errno);
+        return false;
+    }
+    // Raw 8N1 bytes, no echo, no line editing, no flow control.
+    termios settings;
+    if (tcgetattr(m_fd, &settings) != 0) {
+        qWarning() << device << "is not a terminal:" << strerror(errno);
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    cfmakeraw(&settings);
+    settings.c_cflag |= CLOCAL | CREAD;
+    settings.c_cflag &= ~(CSTOPB | CRTSCTS);
+    settings.c_iflag &= ~(IXON | IXOFF | IXANY);
+    settings.c_cc[VMIN] = 1;
+    settings.c_cc[VTIME] = 0;
+    cfsetispeed(&settings, speed);
+    cfsetospeed(&settings, speed);
+    if (tcsetattr(m_fd, TCSANOW, &settings) != 0) {
+        qWarning() << "Unable to configure" << device << ":" << strerror(errno);
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    // Keep other programs off the port while it is in use.
+    ioctl(m_fd, TIOCEXCL);
+    // Ask the driver not to hold bytes back; USB serial adapters otherwise
+    // batch them for up to 16 ms. Pseudo-terminals and some drivers do not
+    // support this, and do not need it.
+    serial_struct serial;
+    if (ioctl(m_fd, TIOCGSERIAL, &serial) == 0) {
+        serial.flags |= ASYNC_LOW_LATENCY;
+        ioctl(m_fd, TIOCSSERIAL, &serial);
+    }
+    // Whatever arrived before is stale by now.
+    tcflush(m_fd, TCIFLUSH);
+    return true;
+#else
+    Q_UNUSED(device);
+    Q_UNUSED(baudRate);
+    qWarning() << "Serial input is only available on Linux";
+    return false;
+#endif
+}
+
+
+void
+SerialSource::setFilters(const QVector<OrientationFilter::Stage> &stages) {
+    m_handler.setFilters(stages);
+}
+
+
+void
+SerialSource::stop() {
+    requestInterruption();
+}
+
+
+ReceiverStatistics
+SerialSource::statistics() const {
+    return m_handler.statistics();
+}
+
+
+void
+SerialSource::run() {
+#ifdef Q_OS_LINUX
+    char buffer[4096];
+    bool hungUp = false;
+    while (!isInterruptionRequested()) {
+        // The timeout only bounds how long stop() can go unnoticed.
+        pollfd descriptor = { m_fd, POLLIN, 0 };
+        if (poll(&descriptor, 1, 100) <= 0)
+            continue;
+        const ssize_t size = read(m_fd, buffer, sizeof(buffer));
+        if (size > 0) {
+            hungUp = false;
+            m_framer.feed(buffer, int(size), &m_handler, SensorClock::now());
+        } else if (size == 0 || (errno != EAGAIN && errno != EINTR)) {
+            // Unplugged, or the other side of a pseudo-terminal went away;
+            // it may come back, so keep waiting without spinning.
+            if (!hungUp)
+                qWarning() << "Serial port" << m_device << "hung up";
+            hungUp = true;
+            msleep(100);
+        }
+    }
+#endif
+}
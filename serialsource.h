@@ -0,0 +1,41 @@
+#pragma once
+
+#include "packethandler.h"
+#include "serialframer.h"
+
+#include <QString>
+#include <QThread>
+
+
+// Input from sensors wired to a serial port, such as IMUs behind a USB
+// serial adapter, without a bridge process re-sending them over UDP.
+//
+// Runs on its own thread, which waits on the port and splits what arrives
+// into packets with a SerialFramer; those go through the same PacketHandler
+// path as UDP datagrams. The port is set to raw mode with no flow control
+// and asks the driver for low latency, so bytes are handed over as soon as
+// they arrive rather than when a driver buffer or timer fills. Any
+// terminal device works, including the slave side of a pseudo-terminal.
+// Only available on Linux.
+class SerialSource : public QThread
+{
+    Q_OBJECT
+public:
+    SerialSource(SensorTable *table, QObject *parent = nullptr);
+    ~SerialSource();
+
+    bool open(const QString &device, int baudRate);
+    // Must be called before the thread is started.
+    void setFilters(const QVector<OrientationFilter::Stage> &stages);
+    void stop();
+    ReceiverStatistics statistics() const;
+
+protected:
+    void run() override;
+
+private:
+    QString m_device;
+    int m_fd;
+    PacketHandler m_handler;
+    SerialFramer m_framer;
+};
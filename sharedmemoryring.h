@@ -0,0 +1,78 @@
+#pragma once
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+
+#include <atomic>
+#include <cstring>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+// Layout of the POSIX shared-memory object through which a sensor bridge
+// on the same host hands packets to us: a single-producer, single-consumer
+// ring of fixed-size slots, each holding one packet in the SensorProtocol
+// wire format.
+//
+// The viewer creates and initializes the object (see SharedMemorySource);
+// the bridge maps it, checks magic and version, and calls push(). The
+// consumer sleeps on a futex when the ring is empty, and push() only makes
+// a system call to wake it up when it is actually sleeping.
+//
+// This header is meant to be usable by bridges as is.
+struct SharedMemoryRing
+{
+    enum {
+        Magic = 0x52535241, // "ARSR"
+        Version = 1,
+        SlotSize = 2048,
+        SlotCount = 1024,   // power of two
+        MaxPacketSize = SlotSize - 64
+    };
+
+    struct alignas(64) Slot
+    {
+        quint32 size;
+        char padding[60];
+        char data[MaxPacketSize];
+    };
+
+    quint32 magic;
+    quint32 version;
+    quint32 slotSize;
+    quint32 slotCount;
+    alignas(64) std::atomic<quint64> head;      // next slot the producer writes
+    alignas(64) std::atomic<quint64> tail;      // next slot the consumer reads
+    alignas(64) std::atomic<quint32> doorbell;  // futex word, bumped to wake the consumer
+    std::atomic<quint32> sleeping;              // set while the consumer may be waiting
+    Slot entries[SlotCount];
+
+    bool isValid() const {
+        return magic == Magic && version == Version
+            && slotSize == SlotSize && slotCount == SlotCount;
+    }
+
+    // Producer side. Returns false if the ring is full or the packet too big.
+    bool push(const void *packet, quint32 size) {
+        const quint64 position = head.load(std::memory_order_relaxed);
+        if (size > MaxPacketSize || position - tail.load(std::memory_order_acquire) >= SlotCount)
+            return false;
+        Slot &slot = entries[position % SlotCount];
+        slot.size = size;
+        memcpy(slot.data, packet, size);
+        head.store(position + 1, std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_seq_cst))
+            ring();
+        return true;
+    }
+
+    void ring() {
+        doorbell.fetch_add(1, std::memory_order_seq_cst);
+        syscall(SYS_futex, reinterpret_cast<quint32 *>(&doorbell), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+    }
+};
+
+#endif // Q_OS_LINUX
@@ -0,0 +1,187 @@
+#include "sharedmemorysource.h"
+#include "hotlog.h"
+#include "sensorclock.h"
+#include "sharedmemoryring.h"
+
+#include <QDebug>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+//============================================================================//
+//                             SharedMemorySource                             //
+//============================================================================//
+
+SharedMemorySource::SharedMemorySource(SensorTable *table, QObject *parent)
+    : QThread(parent)
+    , m_ring(nullptr)
+    , m_tail(0)
+    , m_handler(table)
+{
+    setObjectName(QStringLiteral("Sensor shared memory"));
+}
+
+
+SharedMemorySource::~SharedMemorySource() {
+    stop();
+    wait();
+#ifdef Q_OS_LINUX
+    if (m_ring)
+        munmap(m_ring, sizeof(SharedMemoryRing));
+#endif
+}
+
+
+bool
+SharedMemorySource::open(const QString &name) {
+#ifdef Q_OS_LINUX
+    m_name = name.startsWith(QLatin1Char('/')) ? name : QLatin1Char('/') + name;
+    const QByteArray path = m_name.toLocal8Bit();
+    const int fd = shm_open(path.constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0660);
+    if (fd < 0) {
+        qWarning() << "shm_open" << m_name << "failed:" << strerror(errno);
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0
+            || (status.st_size < off_t(sizeof(SharedMemoryRing))
+                && ftruncate(fd, sizeof(SharedMemoryRing)) != 0)) {
+        qWarning() << "Unable to size shared memory" << m_name << ":" << strerror(errno);
+        close(fd);
+        return false;
+    }
+    void *memory = mmap(nullptr, sizeof(SharedMemoryRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        qWarning() << "mmap" << m_name << "failed:" << strerror(errno);
+        return false;
+    }
+    m_ring = static_cast<SharedMemoryRing *>(memory);
+    if (!m_ring->isValid()) {
+        // A fresh object is all zeros; set it up before any bridge uses it.
+        m_ring->slotSize = SharedMemoryRing::SlotSize;
+        m_ring->slotCount = SharedMemoryRing::SlotCount;
+        m_ring->version = SharedMemoryRing::Version;
+        m_ring->head.store(0);
+        m_ring->tail.store(0);
+        m_ring->sleeping.store(0);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_ring->magic = SharedMemoryRing::Magic;
+    } else {
+        // Whatever a previous viewer left behind is stale by now.
+        m_ring->tail.store(m_ring->head.load());
+    }
+    m_tail = m_ring->tail.load();
+    return true;
+#else
+    Q_UNUSED(name);
+    qWarning() << "Shared-memory input is only available on Linux";
+    return false;
+#endif
+}
+
+
+void
+SharedMemorySource::setFilters(const QVector<OrientationFilter::Stage> &stages) {
+    m_handler.setFilters(stages);
+}
+
+
+void
+SharedMemorySource::stop() {
+    requestInterruption();
+#ifdef Q_OS_LINUX
+    if (m_ring)
+        m_ring->ring();
+#endif
+}
+
+
+ReceiverStatistics
+SharedMemorySource::statistics() const {
+    return m_handler.statistics();
+}
+
+
+void
+SharedMemorySource::run() {
+#ifdef Q_OS_LINUX
+    // Roughly tens of microseconds of polling before going to sleep.
+    const int spins = 2000;
+    while (!isInterruptionRequested()) {
+        bool busy = false;
+        for (int i = 0; i < spins && !busy; ++i)
+            busy = drain();
+        if (!busy)
+            waitForDoorbell();
+    }
+#endif
+}
+
+
+#ifdef Q_OS_LINUX
+// Handles every packet published so far, straight out of the ring.
+//
+// The ring is writable by another process, so nothing read from it is
+// trusted: a head more than a ring ahead of the tail, or behind it, means
+// the producer is broken, and the reader skips to it rather than loop over
+// slots that do not exist. Each slot's size is read once, so the producer
+// cannot change it between the check and the parse.
+bool
+SharedMemorySource::drain() {
+    const quint64 head = m_ring->head.load(std::memory_order_acquire);
+    quint64 tail = m_tail;
+    if (head == tail)
+        return false;
+    if (head - tail > SharedMemoryRing::SlotCount) {
+        HotLog::log(HotLog::CorruptRing, qint64(head - tail));
+        m_tail = head;
+        m_ring->tail.store(head, std::memory_order_release);
+        return true;
+    }
+    const qint64 now = SensorClock::now();
+    for (; tail != head; ++tail) {
+        const SharedMemoryRing::Slot &slot = m_ring->entries[tail % SharedMemoryRing::SlotCount];
+        const quint32 size = *static_cast<const volatile quint32 *>(&slot.size);
+        if (size > SharedMemoryRing::MaxPacketSize)
+            m_handler.countTruncated();
+        else
+            m_handler.handle(slot.data, int(size), now);
+    }
+    m_tail = tail;
+    m_ring->tail.store(tail, std::memory_order_release);
+    return true;
+}
+
+
+// Waits for the producer's doorbell. The timeout only bounds how long a
+// lost wake-up could go unnoticed.
+void
+SharedMemorySource::waitForDoorbell() {
+    m_ring->sleeping.store(1, std::memory_order_seq_cst);
+    const quint32 doorbell = m_ring->doorbell.load(std::memory_order_seq_cst);
+    if (m_ring->head.load(std::memory_order_seq_cst) == m_tail && !isInterruptionRequested()) {
+        timespec timeout = { 0, 100000000 };
+        syscall(SYS_futex, reinterpret_cast<quint32 *>(&m_ring->doorbell), FUTEX_WAIT,
+                doorbell, &timeout, nullptr, 0);
+    }
+    m_ring->sleeping.store(0, std::memory_order_relaxed);
+}
+#else
+bool
+SharedMemorySource::drain() {
+    return false;
+}
+
+
+void
+SharedMemorySource::waitForDoorbell() {
+}
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "packethandler.h"
+
+#include <QString>
+#include <QThread>
+
+struct SharedMemoryRing;
+
+
+// Input from a sensor bridge on the same host through a SharedMemoryRing.
+//
+// Runs on its own thread, which spins briefly when the ring runs dry and
+// then sleeps on the ring's futex doorbell. Packets are parsed in place in
+// the shared memory and go through the same PacketHandler path as UDP
+// datagrams; the sensors fed this way must not also be fed over UDP.
+// Only available on Linux.
+class SharedMemorySource : public QThread
+{
+    Q_OBJECT
+public:
+    SharedMemorySource(SensorTable *table, QObject *parent = nullptr);
+    ~SharedMemorySource();
+
+    // Creates the shared-memory object if needed, and maps it.
+    bool open(const QString &name);
+    // Must be called before the thread is started.
+    void setFilters(const QVector<OrientationFilter::Stage> &stages);
+    void stop();
+    ReceiverStatistics statistics() const;
+
+protected:
+    void run() override;
+
+private:
+    bool drain();
+    void waitForDoorbell();
+
+    QString m_name;
+    SharedMemoryRing *m_ring;
+    // Next slot to read. The ring's own tail only tells the producer; the
+    // bridge could write anything there.
+    quint64 m_tail;
+    PacketHandler m_handler;
+};
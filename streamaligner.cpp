@@ -0,0 +1,264 @@
+#include "streamaligner.h"
+#include "sensorclock.h"
+
+#include <cmath>
+
+
+// Longest the thread sleeps between two looks at the SampleBus, in
+// nanoseconds, however long until the next frame.
+static const qint64 MaxPollInterval = 5000000;
+
+
+//============================================================================//
+//                                StreamAligner                               //
+//============================================================================//
+
+StreamAligner::StreamAligner(SensorTable *table, QObject *parent)
+    : QThread(parent)
+    , m_table(table)
+    , m_consumer(table->bus().addConsumer(SampleBus::Lossy))
+    , m_period(1000000000 / 100)
+    , m_delay(20000000)
+    , m_lastFrameTime(0)
+    , m_frameCount(0)
+{
+    setObjectName(QStringLiteral("Sensor stream aligner"));
+    for (History &history : m_histories)
+        history.count = 0;
+    for (int i = 0; i < Capacity; ++i) {
+        m_frame.state[i] = Missing;
+        m_frame.w[i] = 1.0f;
+        m_frame.x[i] = 0.0f;
+        m_frame.y[i] = 0.0f;
+        m_frame.z[i] = 0.0f;
+        m_frame.arrivalTime[i] = 0;
+        m_frame.sampleTime[i] = 0;
+        m_frame.synchronized[i] = false;
+    }
+}
+
+
+StreamAligner::~StreamAligner() {
+    stop();
+    wait();
+}
+
+
+void
+StreamAligner::setRate(int rate) {
+    m_period = 1000000000 / qBound(1, rate, 1000);
+}
+
+
+void
+StreamAligner::setDelay(int milliseconds) {
+    m_delay = qint64(qBound(0, milliseconds, int(MaxDelay))) * 1000000;
+}
+
+
+void
+StreamAligner::stop() {
+    requestInterruption();
+}
+
+
+bool
+StreamAligner::frame(quint64 index, Frame *frame) const {
+    if (index >= frameCount())
+        return false;
+    if (!m_frames[index % FrameCapacity].load(frame))
+        return false;
+    return frame->index == index;
+}
+
+
+bool
+StreamAligner::latest(Frame *frame) const {
+    const quint64 count = frameCount();
+    return count > 0 && this->frame(count - 1, frame);
+}
+
+
+AlignerStatistics
+StreamAligner::statistics() const {
+    AlignerStatistics statistics;
+    statistics.frames = m_made.value();
+    statistics.skipped = m_skipped.value();
+    statistics.late = m_late.value();
+    statistics.truncated = m_truncated.value();
+    statistics.lost = m_consumer ? m_consumer->lost() : 0;
+    return statistics;
+}
+
+
+void
+StreamAligner::run() {
+    if (!m_consumer)
+        return;
+    // The first frame is the first whole period not due yet.
+    qint64 next = (SensorClock::now() - m_delay) / m_period * m_period + m_period;
+    quint64 index = 0;
+    while (!isInterruptionRequested()) {
+        receive();
+        const qint64 now = SensorClock::now();
+        const qint64 due = now - m_delay;
+        if (due >= next) {
+            // Frames the ring could not keep anyway are not made.
+            const qint64 behind = (due - next) / m_period + 1;
+            if (behind > FrameCapacity) {
+                m_skipped.add(quint64(behind - FrameCapacity));
+                next += (behind - FrameCapacity) * m_period;
+            }
+            for (; next <= due; next += m_period)
+                makeFrame(index++, next);
+        }
+        const qint64 wait = qBound(qint64(0), next + m_delay - SensorClock::now(), MaxPollInterval);
+        usleep(quint64(wait / 1000));
+    }
+}
+
+
+void
+StreamAligner::receive() {
+    const int max = int(sizeof(m_samples) / sizeof(m_samples[0]));
+    int n;
+    do {
+        n = m_consumer->poll(m_samples, max);
+        for (int i = 0; i < n; ++i)
+            push(m_samples[i]);
+    } while (n == max);
+}
+
+
+// Samples no newer than the newest of their stream are dropped.
+void
+StreamAligner::push(const SensorSample &sample) {
+    if (sample.sensorId >= Capacity)
+        return;
+    History &history = m_histories[sample.sensorId];
+    if (history.count > 0
+            && sample.sampleTime <= history.time[(history.count - 1) % HistorySize])
+        return;
+    if (sample.sampleTime <= m_lastFrameTime)
+        m_late.add();
+    const quint32 slot = history.count % HistorySize;
+    history.time[slot] = sample.sampleTime;
+    history.arrivalTime[slot] = sample.arrivalTime;
+    history.orientation[slot] = sample.orientation();
+    history.synchronized[slot] = sample.synchronized;
+    ++history.count;
+}
+
+
+void
+StreamAligner::makeFrame(quint64 index, qint64 time) {
+    const int streamCount = qMin(m_table->streamCount(), int(Capacity));
+    int lanes = 0;
+    for (int id = 0; id < streamCount; ++id) {
+        const History &history = m_histories[id];
+        // The newest sample at or before time, searching back from the
+        // newest, which is where time usually is.
+        const qint64 newest = qint64(history.count) - 1;
+        const qint64 oldest = qMax(qint64(0), qint64(history.count) - HistorySize);
+        qint64 k = newest;
+        while (k >= oldest && history.time[k % HistorySize] > time)
+            --k;
+        if (k < oldest && oldest > 0) {
+            // Every sample kept is newer than time, those before it having
+            // been overwritten already: hold the oldest.
+            k = oldest;
+            m_truncated.add();
+        }
+        if (k < oldest) {
+            m_frame.state[id] = Missing;
+            m_frame.w[id] = 1.0f;
+            m_frame.x[id] = 0.0f;
+            m_frame.y[id] = 0.0f;
+            m_frame.z[id] = 0.0f;
+            m_frame.arrivalTime[id] = 0;
+            m_frame.sampleTime[id] = 0;
+            m_frame.synchronized[id] = false;
+            continue;
+        }
+        const int from = int(k % HistorySize);
+        const int to = k == newest || history.time[from] > time
+                       ? from : int((k + 1) % HistorySize);
+        const QuaternionMath::Quaternion &a = history.orientation[from];
+        const QuaternionMath::Quaternion &b = history.orientation[to];
+        m_batch.a0[lanes] = a.w;
+        m_batch.a1[lanes] = a.x;
+        m_batch.a2[lanes] = a.y;
+        m_batch.a3[lanes] = a.z;
+        m_batch.b0[lanes] = b.w;
+        m_batch.b1[lanes] = b.x;
+        m_batch.b2[lanes] = b.y;
+        m_batch.b3[lanes] = b.z;
+        m_batch.t[lanes] = from == to ? 0.0f
+                           : float(time - history.time[from])
+                             / float(history.time[to] - history.time[from]);
+        m_batch.stream[lanes] = id;
+        m_frame.state[id] = from == to ? Held : Interpolated;
+        m_frame.arrivalTime[id] = history.arrivalTime[to];
+        m_frame.sampleTime[id] = history.time[to];
+        m_frame.synchronized[id] = history.synchronized[to];
+        ++lanes;
+    }
+    interpolate(lanes);
+    for (int i = 0; i < lanes; ++i) {
+        const int id = m_batch.stream[i];
+        m_frame.w[id] = m_batch.a0[i];
+        m_frame.x[id] = m_batch.a1[i];
+        m_frame.y[id] = m_batch.a2[i];
+        m_frame.z[id] = m_batch.a3[i];
+    }
+    m_frame.index = index;
+    m_frame.time = time;
+    m_frame.streamCount = streamCount;
+    m_frames[index % FrameCapacity].store(m_frame);
+    m_frameCount.store(index + 1, std::memory_order_release);
+    m_lastFrameTime = time;
+    m_made.add();
+}
+
+
+// QuaternionMath::slerp over the lanes, leaving the results in a. Only the
+// weights need trigonometry and are worked out one lane at a time; the
+// loops around them are branch-free and vectorize.
+void
+StreamAligner::interpolate(int lanes) {
+    Batch &batch = m_batch;
+    for (int i = 0; i < lanes; ++i) {
+        const float cosine = batch.a0[i] * batch.b0[i] + batch.a1[i] * batch.b1[i]
+                             + batch.a2[i] * batch.b2[i] + batch.a3[i] * batch.b3[i];
+        // The short way round.
+        const float sign = cosine < 0.0f ? -1.0f : 1.0f;
+        batch.b0[i] *= sign;
+        batch.b1[i] *= sign;
+        batch.b2[i] *= sign;
+        batch.b3[i] *= sign;
+        batch.cosine[i] = cosine * sign;
+    }
+    for (int i = 0; i < lanes; ++i) {
+        const float t = batch.t[i];
+        if (batch.cosine[i] < 0.9995f) {
+            const float angle = std::acos(batch.cosine[i]);
+            const float s = 1.0f / std::sin(angle);
+            batch.wa[i] = std::sin((1.0f - t) * angle) * s;
+            batch.wb[i] = std::sin(t * angle) * s;
+        } else {
+            batch.wa[i] = 1.0f - t;
+            batch.wb[i] = t;
+        }
+    }
+    for (int i = 0; i < lanes; ++i) {
+        const float q0 = batch.wa[i] * batch.a0[i] + batch.wb[i] * batch.b0[i];
+        const float q1 = batch.wa[i] * batch.a1[i] + batch.wb[i] * batch.b1[i];
+        const float q2 = batch.wa[i] * batch.a2[i] + batch.wb[i] * batch.b2[i];
+        const float q3 = batch.wa[i] * batch.a3[i] + batch.wb[i] * batch.b3[i];
+        const float scale = 1.0f / std::sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+        batch.a0[i] = q0 * scale;
+        batch.a1[i] = q1 * scale;
+        batch.a2[i] = q2 * scale;
+        batch.a3[i] = q3 * scale;
+    }
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "quaternionmath.h"
+#include "samplebus.h"
+#include "seqlock.h"
+#include "sensorstatistics.h"
+#include "sensortable.h"
+
+#include <QThread>
+
+
+// Resamples every sensor stream onto one timeline, so that what is shown or
+// computed from several sensors at once, such as the angle between two of
+// them, comes from the same instant rather than from whatever each stream
+// last sent.
+//
+// Frames are taken at whole multiples of the period on SensorClock, from
+// the sample times of the streams: the senders' own timestamps for streams
+// whose clocks are synchronized (see ClockSync), arrival estimates for the
+// others. The frame at time T is made once T is delay old, so that samples
+// of every stream around T have had time to arrive, and holds for each
+// stream the slerp of its two samples around T. A stream with no sample
+// after T yet holds its newest one; one with none before T is missing,
+// unless it sends so fast that the samples before T have already left
+// its history, when it holds its oldest kept sample and is counted as
+// truncated.
+// The streams of a frame are interpolated together, in structure-of-arrays
+// batches.
+//
+// Runs on its own thread as a lossy SampleBus consumer, so ingest never
+// waits for it. The newest FrameCapacity frames can be read from any
+// thread without a lock.
+class StreamAligner : public QThread
+{
+    Q_OBJECT
+public:
+    enum {
+        Capacity = SensorTable::Capacity,
+        FrameCapacity = 8,
+        // Samples kept per stream; enough for the default delay at up to
+        // 3 kHz.
+        HistorySize = 64
+    };
+    // Longest delay setDelay() takes, in milliseconds.
+    static const int MaxDelay = 1000;
+
+    enum State : quint8 {
+        Missing,
+        Interpolated,
+        Held
+    };
+
+    struct Frame
+    {
+        // Frame number, from 0, and its time on SensorClock.
+        quint64 index = 0;
+        qint64 time = 0;
+        int streamCount = 0;
+        State state[Capacity];
+        float w[Capacity];
+        float x[Capacity];
+        float y[Capacity];
+        float z[Capacity];
+        // Arrival and sample times of the newer of the two samples each
+        // stream was interpolated from, and whether its sender's clock
+        // was synchronized, for measuring how old what is shown is.
+        qint64 arrivalTime[Capacity];
+        qint64 sampleTime[Capacity];
+        bool synchronized[Capacity];
+    };
+
+    // Must be created before the ingest threads start.
+    StreamAligner(SensorTable *table, QObject *parent = nullptr);
+    ~StreamAligner();
+
+    // Frames per second, and how old a frame's time is when it is made,
+    // in milliseconds, at most MaxDelay; must be called before the thread
+    // is started.
+    void setRate(int rate);
+    void setDelay(int milliseconds);
+    void stop();
+
+    // Frames made so far; the newest has index frameCount() - 1. May be
+    // called from any thread, as may frame() and latest().
+    quint64 frameCount() const { return m_frameCount.load(std::memory_order_acquire); }
+    // Returns false if that frame has not been made, has been overwritten
+    // already or was being written.
+    bool frame(quint64 index, Frame *frame) const;
+    bool latest(Frame *frame) const;
+    AlignerStatistics statistics() const;
+
+protected:
+    void run() override;
+
+private:
+    struct History
+    {
+        qint64 time[HistorySize];
+        qint64 arrivalTime[HistorySize];
+        QuaternionMath::Quaternion orientation[HistorySize];
+        bool synchronized[HistorySize];
+        // Samples pushed so far.
+        quint32 count;
+    };
+
+    void receive();
+    void push(const SensorSample &sample);
+    void makeFrame(quint64 index, qint64 time);
+    void interpolate(int lanes);
+
+    SensorTable *m_table;
+    SampleBus::Consumer *m_consumer;
+    qint64 m_period;
+    qint64 m_delay;
+    // Time of the newest frame made, samples older than which are late.
+    qint64 m_lastFrameTime;
+    History m_histories[Capacity];
+    SensorSample m_samples[1024];
+
+    // The lanes of the batch being interpolated: slerp(a, b, t) into out.
+    struct Batch
+    {
+        alignas(64) float a0[Capacity];
+        alignas(64) float a1[Capacity];
+        alignas(64) float a2[Capacity];
+        alignas(64) float a3[Capacity];
+        alignas(64) float b0[Capacity];
+        alignas(64) float b1[Capacity];
+        alignas(64) float b2[Capacity];
+        alignas(64) float b3[Capacity];
+        alignas(64) float t[Capacity];
+        alignas(64) float cosine[Capacity];
+        alignas(64) float wa[Capacity];
+        alignas(64) float wb[Capacity];
+        int stream[Capacity];
+    };
+    Batch m_batch;
+    Frame m_frame;
+
+    SeqLock<Frame> m_frames[FrameCapacity];
+    std::atomic<quint64> m_frameCount;
+    StatisticsCounter m_made;
+    StatisticsCounter m_skipped;
+    StatisticsCounter m_late;
+    StatisticsCounter m_truncated;
+};
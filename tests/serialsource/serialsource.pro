@@ -0,0 +1,31 @@
+QT += testlib
+QT -= gui
+
+CONFIG += testcase console
+CONFIG -= app_bundle
+
+TARGET = tst_serialsource
+
+# As in boxes.pro.
+gcc: QMAKE_CXXFLAGS += -fno-math-errno
+
+INCLUDEPATH += ../..
+
+HEADERS += ../../hotlog.h \
+           ../../serialsource.h
+
+SOURCES += tst_serialsource.cpp \
+           ../../calibrator.cpp \
+           ../../clocksync.cpp \
+           ../../hotlog.cpp \
+           ../../imufusion.cpp \
+           ../../jitterbuffer.cpp \
+           ../../orientationfilter.cpp \
+           ../../oscprotocol.cpp \
+           ../../packethandler.cpp \
+           ../../samplebus.cpp \
+           ../../sensorprotocol.cpp \
+           ../../sensortable.cpp \
+           ../../serialframer.cpp \
+           ../../serialsource.cpp \
+           ../../velocityestimator.cpp
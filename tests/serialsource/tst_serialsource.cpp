@@ -0,0 +1,178 @@
+#include "sensorprotocol.h"
+#include "serialframer.h"
+#include "serialsource.h"
+
+#include <QtEndian>
+#include <QtTest>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+// Sends COBS and CRC framed packets through a pseudo-terminal into a
+// SerialSource, as a sensor behind a USB serial adapter would, and checks
+// what its PacketHandler made of them.
+class TestSerialSource : public QObject
+{
+    Q_OBJECT
+private slots:
+    void init();
+    void cleanup();
+    void goodFrames();
+    void corruptFrames();
+    void hangUp();
+
+private:
+    bool send(const QByteArray &bytes);
+    static QByteArray packet(quint16 sensorId, quint32 sequence);
+    static QByteArray frame(const QByteArray &packet);
+
+    SensorTable *m_table;
+    SerialSource *m_source;
+    int m_master;
+};
+
+
+void
+TestSerialSource::init() {
+    m_table = new SensorTable;
+    m_source = new SerialSource(m_table);
+    m_master = posix_openpt(O_RDWR | O_NOCTTY);
+    QVERIFY(m_master >= 0);
+    QVERIFY(grantpt(m_master) == 0);
+    QVERIFY(unlockpt(m_master) == 0);
+    QVERIFY(m_source->open(QString::fromLocal8Bit(ptsname(m_master)), 115200));
+    m_source->start();
+    // Ends whatever the port saw before, as senders should.
+    QVERIFY(send(QByteArray(1, '\0')));
+}
+
+
+void
+TestSerialSource::cleanup() {
+    m_source->stop();
+    QVERIFY(m_source->wait(2000));
+    delete m_source;
+    delete m_table;
+    if (m_master >= 0)
+        close(m_master);
+}
+
+
+void
+TestSerialSource::goodFrames() {
+    QByteArray bytes;
+    for (quint32 sequence = 1; sequence <= 3; ++sequence)
+        bytes += frame(packet(3, sequence));
+    // Back to back delimiters are idle line, not frames.
+    bytes += QByteArray(3, '\0');
+    bytes += frame(packet(4, 1));
+    QVERIFY(send(bytes));
+
+    QTRY_COMPARE(m_source->statistics().datagrams, quint64(4));
+    QCOMPARE(m_source->statistics().malformed, quint64(0));
+    QCOMPARE(m_table->statistics(3).received, quint64(3));
+    QCOMPARE(m_table->statistics(4).received, quint64(1));
+}
+
+
+void
+TestSerialSource::corruptFrames() {
+    // A flipped bit fails the CRC.
+    QByteArray flipped = frame(packet(3, 2));
+    flipped[3] = char(flipped[3] ^ 0x40);
+    QVERIFY(flipped[3] != '\0');
+    // A dropped byte leaves a COBS block short, or fails the CRC.
+    QByteArray dropped = frame(packet(3, 3));
+    dropped.remove(dropped.size() / 2, 1);
+    // Too short to hold a CRC.
+    const QByteArray tiny = QByteArray::fromHex("0201") + QByteArray(1, '\0');
+
+    QVERIFY(send(frame(packet(3, 1)) + flipped + dropped + tiny + frame(packet(3, 4))));
+
+    QTRY_COMPARE(m_source->statistics().datagrams, quint64(5));
+    QCOMPARE(m_source->statistics().malformed, quint64(3));
+    // The framer resynchronizes at each delimiter, so the frames around
+    // the corrupt ones still get through, and the sequence numbers of
+    // those lost show as a gap.
+    QCOMPARE(m_table->statistics(3).received, quint64(2));
+    QCOMPARE(m_table->statistics(3).lost, quint64(2));
+}
+
+
+void
+TestSerialSource::hangUp() {
+    QVERIFY(send(frame(packet(3, 1))));
+    QTRY_COMPARE(m_source->statistics().datagrams, quint64(1));
+
+    // Half a frame, then the other side goes away, as when a sensor is
+    // unplugged: what was cut off is never handed over.
+    const QByteArray cut = frame(packet(3, 2));
+    QVERIFY(send(cut.left(cut.size() / 2)));
+    close(m_master);
+    m_master = -1;
+    QTest::qWait(300);
+
+    const ReceiverStatistics statistics = m_source->statistics();
+    QCOMPARE(statistics.datagrams, quint64(1));
+    QCOMPARE(statistics.malformed, quint64(0));
+    QCOMPARE(m_table->statistics(3).received, quint64(1));
+    // The thread keeps waiting for the port without spinning, and still
+    // stops when asked; cleanup() checks that.
+    QVERIFY(m_source->isRunning());
+}
+
+
+bool
+TestSerialSource::send(const QByteArray &bytes) {
+    return write(m_master, bytes.constData(), size_t(bytes.size())) == bytes.size();
+}
+
+
+// A one-sample OrientationBatch packet.
+QByteArray
+TestSerialSource::packet(quint16 sensorId, quint32 sequence) {
+    QByteArray data(SensorProtocol::HeaderSize + SensorProtocol::RecordHeaderSize + 6, '\0');
+    SensorProtocol::writeHeader(data.data(), SensorProtocol::OrientationBatch, 0,
+                                SensorProtocol::SmallestThree48);
+    SensorSample sample;
+    sample.sensorId = sensorId;
+    sample.sampleTime = qint64(sequence) * 10000000;
+    SensorProtocol::writeRecord(data.data() + SensorProtocol::HeaderSize, sample, sequence);
+    return data;
+}
+
+
+// COBS(packet, CRC) and a delimiter, as SerialFramer expects.
+QByteArray
+TestSerialSource::frame(const QByteArray &packet) {
+    QByteArray data = packet;
+    char crc[SerialFramer::CrcSize];
+    qToLittleEndian<quint16>(SerialFramer::crc16(packet.constData(), packet.size()), crc);
+    data.append(crc, sizeof(crc));
+
+    QByteArray encoded(1, '\0');
+    int code = 0;
+    quint8 length = 1;
+    for (char byte : qAsConst(data)) {
+        if (byte != '\0') {
+            encoded.append(byte);
+            ++length;
+        }
+        if (byte == '\0' || length == 0xff) {
+            encoded[code] = char(length);
+            code = encoded.size();
+            encoded.append('\0');
+            length = 1;
+        }
+    }
+    encoded[code] = char(length);
+    encoded.append('\0');
+    return encoded;
+}
+
+
+QTEST_GUILESS_MAIN(TestSerialSource)
+
+#include "tst_serialsource.moc"
@@ -0,0 +1,54 @@
+#include "threadtuning.h"
+
+#include <QDebug>
+
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+bool
+ThreadTuning::pinToCpu(int cpu) {
+#ifdef Q_OS_LINUX
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        qWarning() << "No such CPU:" << cpu;
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    const int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (error != 0) {
+        qWarning() << "Unable to pin thread to CPU" << cpu << ":" << strerror(error);
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(cpu);
+    qWarning() << "CPU pinning is only available on Linux";
+    return false;
+#endif
+}
+
+
+bool
+ThreadTuning::setRealtime(int priority) {
+#ifdef Q_OS_LINUX
+    sched_param parameters = {};
+    parameters.sched_priority = qBound(sched_get_priority_min(SCHED_FIFO), priority,
+                                       sched_get_priority_max(SCHED_FIFO));
+    const int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &parameters);
+    if (error != 0) {
+        qWarning() << "Unable to switch thread to SCHED_FIFO:" << strerror(error);
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(priority);
+    qWarning() << "Real-time scheduling is only available on Linux";
+    return false;
+#endif
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <QtGlobal>
+
+
+// Scheduling tweaks for latency-critical threads. Both apply to the
+// calling thread, report failure with a warning and return false; they
+// are only implemented on Linux.
+namespace ThreadTuning
+{
+    // Restricts the calling thread to one CPU.
+    bool pinToCpu(int cpu);
+    // Moves the calling thread to the SCHED_FIFO real-time class at
+    // priority (1-99). Usually needs CAP_SYS_NICE or an rtprio limit.
+    bool setRealtime(int priority);
+}
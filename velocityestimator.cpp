@@ -0,0 +1,54 @@
+#include "velocityestimator.h"
+#include "quaternionmath.h"
+
+using namespace QuaternionMath;
+
+
+//============================================================================//
+//                              VelocityEstimator                             //
+//============================================================================//
+
+// Weight of the newest measurement in the running average.
+static const float Smoothing = 0.5f;
+// Gaps longer than this mean the stream stalled, so start over.
+static const qint64 MaximumInterval = 250000000;
+
+
+VelocityEstimator::VelocityEstimator()
+    : m_hasReference(false)
+    , m_velocity{0.0f, 0.0f, 0.0f}
+{
+}
+
+
+void
+VelocityEstimator::update(SensorSample *sample) {
+    const qint64 interval = sample->sampleTime - m_reference.sampleTime;
+    if (!m_hasReference || interval > MaximumInterval || interval < 0) {
+        m_velocity[0] = m_velocity[1] = m_velocity[2] = 0.0f;
+        m_reference = *sample;
+        m_hasReference = true;
+    } else if (interval >= MinimumInterval) {
+        // World-frame rotation from the reference to this sample.
+        const Quaternion delta = multiply(sample->orientation(), conjugate(m_reference.orientation()));
+        float rotation[3];
+        toRotationVector(delta, rotation);
+        const float seconds = interval * 1.0e-9f;
+        for (int i = 0; i < 3; ++i)
+            m_velocity[i] += Smoothing * (rotation[i] / seconds - m_velocity[i]);
+        m_reference = *sample;
+    }
+    sample->vx = m_velocity[0];
+    sample->vy = m_velocity[1];
+    sample->vz = m_velocity[2];
+}
+
+
+QuaternionMath::Quaternion
+VelocityEstimator::extrapolate(const SensorSample &sample, qint64 interval) {
+    const float seconds = interval * 1.0e-9f;
+    const Quaternion turn = fromRotationVector(sample.vx * seconds,
+                                               sample.vy * seconds,
+                                               sample.vz * seconds);
+    return normalized(multiply(turn, sample.orientation()));
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "quaternionmath.h"
+#include "sensorsample.h"
+
+
+// Estimates the angular velocity of one sensor stream from successive
+// orientations, the sensor counterpart of TrackBall's axis and angular
+// velocity. The rate is smoothed, and samples closer together than
+// MinimumInterval (typically the tail of a burst) are not used for it.
+class VelocityEstimator
+{
+public:
+    enum { MinimumInterval = 2000000 }; // nanoseconds
+
+    VelocityEstimator();
+
+    // Fills in the angular velocity of sample.
+    void update(SensorSample *sample);
+
+    // Orientation of sample after turning for another interval nanoseconds
+    // at its angular velocity.
+    static QuaternionMath::Quaternion extrapolate(const SensorSample &sample, qint64 interval);
+
+private:
+    SensorSample m_reference;
+    bool m_hasReference;
+    float m_velocity[3];
+};